@@ -1,259 +1,3996 @@
 // FullText.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
 
+//platform headers come before using namespace std, windows.h declares its own byte
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cerrno>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include <iostream>
 using namespace std;
 #include <fstream>
 #include <string>
 #include <set>
-#include <unordered_set>
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string_view>
+#include <sstream>
+#include <map>
+#include <list>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <climits>
+#include <chrono>
+#include <deque>
+#include <functional>
+
+//Whole file mapped read only into memory, empty view when it cannot be opened or is empty
+class mappedFile
+{
+public:
+	explicit mappedFile(const string& path)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL)
+			{
+				data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				size = data != nullptr ? size_t(fileSize.QuadPart) : 0;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return;
+		}
+		struct stat info;
+		if (fstat(file, &info) == 0 && info.st_size > 0)
+		{
+			void* mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapping != MAP_FAILED)
+			{
+				data = static_cast<const char*>(mapping);
+				size = size_t(info.st_size);
+			}
+		}
+		close(file);
+#endif
+	}
+	mappedFile(const mappedFile&) = delete;
+	mappedFile& operator=(const mappedFile&) = delete;
+	~mappedFile()
+	{
+		if (data != nullptr)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+#else
+			munmap(const_cast<char*>(data), size);
+#endif
+		}
+	}
+	string_view view() const
+	{
+		return string_view(data, size);
+	}
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+};
+
+/*Splits text into words - maximal runs of letters - and lowercases them. Text is classified and lowercased 16 bytes at a time with SSE2 into a reused
+buffer and words are found from 64 bit masks of letters, so nothing is allocated per word. In UTF-8 mode bytes of multibyte characters are letters
+too, only ASCII letters are lowercased.*/
+class tokenizer
+{
+public:
+	explicit tokenizer(bool utf8 = false) :utf8(utf8) {}
+
+	//calls found(word, offset) for every word, word is lowercased and valid only during the call
+	template<typename Found>
+	void operator()(string_view text, Found&& found)
+	{
+		if (lowered.size() < text.size())
+		{
+			lowered.resize(text.size());
+		}
+		bool inWord = false;
+		size_t start = 0;
+		for (size_t base = 0; base < text.size(); base += 64)
+		{
+			size_t n = std::min<size_t>(64, text.size() - base);
+			uint64_t letters = classify(text.data() + base, lowered.data() + base, n);
+			//bits where a word starts or ends, end of the text in a partial block is a change to non-letter
+			uint64_t changes = letters ^ ((letters << 1) | uint64_t(inWord));
+			while (changes != 0)
+			{
+				unsigned bit = lowestBit(changes);
+				changes &= changes - 1;
+				if ((letters >> bit) & 1)
+				{
+					start = base + bit;
+				}
+				else
+				{
+					found(string_view(lowered.data() + start, base + bit - start), start);
+				}
+			}
+			inWord = n == 64 && (letters >> 63) != 0;
+		}
+		if (inWord)
+		{
+			found(string_view(lowered.data() + start, text.size() - start), start);
+		}
+	}
+
+private:
+	static unsigned lowestBit(uint64_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, mask);
+		return index;
+#else
+		return unsigned(__builtin_ctzll(mask));
+#endif
+	}
+
+	//lowercases n <= 64 bytes into lower, returns mask of letters
+	uint64_t classify(const char* text, char* lower, size_t n) const
+	{
+		uint64_t letters = 0;
+		size_t i = 0;
+#ifdef __SSE2__
+		const __m128i beforeUpper = _mm_set1_epi8('A' - 1);
+		const __m128i afterUpper = _mm_set1_epi8('Z' + 1);
+		const __m128i beforeLower = _mm_set1_epi8('a' - 1);
+		const __m128i afterLower = _mm_set1_epi8('z' + 1);
+		const __m128i caseBit = _mm_set1_epi8(0x20);
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeUpper), _mm_cmplt_epi8(bytes, afterUpper));
+			__m128i folded = _mm_or_si128(bytes, _mm_and_si128(upper, caseBit));
+			__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(folded, beforeLower), _mm_cmplt_epi8(folded, afterLower));
+			if (utf8)
+			{
+				//bytes from 0x80 are negative
+				letter = _mm_or_si128(letter, _mm_cmplt_epi8(bytes, _mm_setzero_si128()));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lower + i), folded);
+			letters |= uint64_t(uint32_t(_mm_movemask_epi8(letter))) << i;
+		}
+#endif
+		for (; i < n; i++)
+		{
+			char c = text[i];
+			char folded = c >= 'A' && c <= 'Z' ? char(c + 'a' - 'A') : c;
+			lower[i] = folded;
+			bool letter = (folded >= 'a' && folded <= 'z') || (utf8 && (unsigned char)c >= 0x80);
+			letters |= uint64_t(letter) << i;
+		}
+		return letters;
+	}
+
+	bool utf8;
+	vector<char> lowered;
+};
+
+/*Answers to queries with W-TinyLFU eviction, size is counted in bytes of queries and answers. New answers enter a small LRU window, those evicted
+from it compete for the main segmented LRU with its victims by estimated frequency of their queries. So a scan of queries seen once cannot flush
+the frequent ones. Frequencies are counted in a count-min sketch, which is halved from time to time so that old popularity fades.*/
+class resultCache
+{
+public:
+	void setCapacity(size_t bytes)
+	{
+		lock_guard<mutex> lock(mtx);
+		capacity = bytes;
+		windowCapacity = std::max<size_t>(bytes / 100, 1);
+		protectedCapacity = (bytes - windowCapacity) * 4 / 5;
+		sketch.resize(std::min<size_t>(std::max<size_t>(bytes / 256, 64), size_t(1) << 22));
+		clearEntries();
+	}
+	bool enabled() const
+	{
+		return capacity != 0;
+	}
+	bool find(const string& key, string& answer)
+	{
+		lock_guard<mutex> lock(mtx);
+		sketch.increment(std::hash<string>()(key));
+		auto existing = entries.find(key);
+		if (existing == entries.end())
+		{
+			misses++;
+			return false;
+		}
+		hits++;
+		auto it = existing->second;
+		switch (it->where)
+		{
+		case window:
+			windowList.splice(windowList.begin(), windowList, it);
+			break;
+		case probation:
+			//second hit promotes to the protected part, its least recently used entries go back to probation
+			it->where = protectedSegment;
+			probationBytes -= it->size();
+			protectedBytes += it->size();
+			protectedList.splice(protectedList.begin(), probationList, it);
+			while (protectedBytes > protectedCapacity)
+			{
+				auto demoted = std::prev(protectedList.end());
+				demoted->where = probation;
+				protectedBytes -= demoted->size();
+				probationBytes += demoted->size();
+				probationList.splice(probationList.begin(), protectedList, demoted);
+			}
+			break;
+		case protectedSegment:
+			protectedList.splice(protectedList.begin(), protectedList, it);
+			break;
+		}
+		answer = it->answer;
+		return true;
+	}
+	void insert(const string& key, const string& answer)
+	{
+		lock_guard<mutex> lock(mtx);
+		if (entries.count(key) != 0 || key.size() + answer.size() + overhead > capacity - windowCapacity)
+		{
+			return;
+		}
+		windowList.push_front({ key, answer, window });
+		entries.emplace(key, windowList.begin());
+		windowBytes += windowList.front().size();
+		while (windowBytes > windowCapacity)
+		{
+			auto candidate = std::prev(windowList.end());
+			windowBytes -= candidate->size();
+			admit(candidate);
+		}
+	}
+	//drops everything, index has changed
+	void clear()
+	{
+		lock_guard<mutex> lock(mtx);
+		clearEntries();
+	}
+	void printStatistics(ostream& out)
+	{
+		lock_guard<mutex> lock(mtx);
+		out << "cache hits " << hits << ", misses " << misses << ", evictions " << evictions << ", bytes "
+			<< windowBytes + probationBytes + protectedBytes << endl;
+	}
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+private:
+	enum segment { window, probation, protectedSegment };
+	static constexpr size_t overhead = 64;
+	class entry
+	{
+	public:
+		string key;
+		string answer;
+		segment where;
+		size_t size() const
+		{
+			return key.size() + answer.size() + overhead;
+		}
+	};
+	using entryList = list<entry>;
+
+	//four rows of saturating counters, estimate is the smallest of them
+	class frequencySketch
+	{
+	public:
+		void resize(size_t entries)
+		{
+			width = 1;
+			while (width < entries)
+			{
+				width *= 2;
+			}
+			counters.assign(4 * width, 0);
+			samples = 0;
+		}
+		uint32_t estimate(size_t hash) const
+		{
+			uint32_t result = UINT8_MAX;
+			for (size_t row = 0; row < 4; row++)
+			{
+				result = std::min<uint32_t>(result, counters[row * width + index(hash, row)]);
+			}
+			return result;
+		}
+		void increment(size_t hash)
+		{
+			uint32_t current = estimate(hash);
+			if (current < UINT8_MAX)
+			{
+				for (size_t row = 0; row < 4; row++)
+				{
+					uint8_t& counter = counters[row * width + index(hash, row)];
+					if (counter == current)
+					{
+						counter++;
+					}
+				}
+			}
+			if (++samples >= 10 * width)
+			{
+				for (auto&& counter : counters)
+				{
+					counter /= 2;
+				}
+				samples /= 2;
+			}
+		}
+	private:
+		size_t index(size_t hash, size_t row) const
+		{
+			uint64_t h = (uint64_t(hash) + row * 0x9e3779b97f4a7c15ull) * 0xff51afd7ed558ccdull;
+			return size_t(h ^ (h >> 32)) & (width - 1);
+		}
+		vector<uint8_t> counters;
+		size_t width = 1;
+		size_t samples = 0;
+	};
+
+	//candidate has left the window, it gets into probation if it is more frequent than the victims which have to make space for it
+	void admit(entryList::iterator candidate)
+	{
+		uint32_t frequency = sketch.estimate(std::hash<string>()(candidate->key));
+		while (probationBytes + protectedBytes + candidate->size() > capacity - windowCapacity)
+		{
+			entryList& victims = probationList.empty() ? protectedList : probationList;
+			auto victim = std::prev(victims.end());
+			if (frequency <= sketch.estimate(std::hash<string>()(victim->key)))
+			{
+				remove(windowList, candidate);
+				return;
+			}
+			(victim->where == probation ? probationBytes : protectedBytes) -= victim->size();
+			remove(victims, victim);
+		}
+		candidate->where = probation;
+		probationBytes += candidate->size();
+		probationList.splice(probationList.begin(), windowList, candidate);
+	}
+	void remove(entryList& from, entryList::iterator it)
+	{
+		entries.erase(it->key);
+		from.erase(it);
+		evictions++;
+	}
+	void clearEntries()
+	{
+		entries.clear();
+		windowList.clear();
+		probationList.clear();
+		protectedList.clear();
+		windowBytes = probationBytes = protectedBytes = 0;
+	}
+
+	mutex mtx;
+	size_t capacity = 0;
+	size_t windowCapacity = 0;
+	size_t protectedCapacity = 0;
+	size_t windowBytes = 0;
+	size_t probationBytes = 0;
+	size_t protectedBytes = 0;
+	entryList windowList;
+	entryList probationList;
+	entryList protectedList;
+	unordered_map<string, entryList::iterator> entries;
+	frequencySketch sketch;
+};
+
+/*Threads which answer shards of queries. Every worker takes tasks from the back of its own deque and when it is empty, steals from the front
+of the others. The thread which runs a batch works on tasks too until its batch is done, so it never idles while its shards wait in queues.*/
+class workStealingPool
+{
+public:
+	explicit workStealingPool(size_t thrs) :queues(std::max<size_t>(thrs, 1))
+	{
+		for (size_t th = 0; th < queues.size(); th++)
+		{
+			workers.emplace_back([this, th]() { work(th); });
+		}
+	}
+	workStealingPool(const workStealingPool&) = delete;
+	workStealingPool& operator=(const workStealingPool&) = delete;
+	~workStealingPool()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto&& worker : workers)
+		{
+			worker.join();
+		}
+	}
+	size_t threads() const
+	{
+		return queues.size();
+	}
+	/*runs all tasks, returns when they are done. Tasks are spread over the deques round robin. They are counted before they are pushed,
+	because take lowers queued as soon as it finds one.*/
+	void run(vector<function<void()>>& tasks)
+	{
+		batch done;
+		done.remaining = tasks.size();
+		size_t first;
+		{
+			lock_guard<mutex> lock(mtx);
+			first = next;
+			next = (next + tasks.size()) % queues.size();
+			queued += tasks.size();
+		}
+		for (size_t i = 0; i < tasks.size(); i++)
+		{
+			taskQueue& q = queues[(first + i) % queues.size()];
+			lock_guard<mutex> lock(q.mtx);
+			q.tasks.push_back({ &tasks[i], &done });
+		}
+		condition.notify_all();
+
+		task t;
+		while (!done.finished() && take(first, t))
+		{
+			execute(t);
+		}
+		unique_lock<mutex> lock(done.mtx);
+		while (done.remaining != 0)
+		{
+			done.condition.wait(lock);
+		}
+	}
+
+private:
+	class batch
+	{
+	public:
+		bool finished()
+		{
+			lock_guard<mutex> lock(mtx);
+			return remaining == 0;
+		}
+		mutex mtx;
+		condition_variable condition;
+		size_t remaining = 0;
+	};
+	class task
+	{
+	public:
+		function<void()>* call;
+		batch* owner;
+	};
+	class taskQueue
+	{
+	public:
+		mutex mtx;
+		deque<task> tasks;
+	};
+
+	//own deque from the back (the most recently added), the others from the front
+	bool take(size_t th, task& t)
+	{
+		for (size_t i = 0; i < queues.size(); i++)
+		{
+			taskQueue& q = queues[(th + i) % queues.size()];
+			lock_guard<mutex> lock(q.mtx);
+			if (!q.tasks.empty())
+			{
+				if (i == 0)
+				{
+					t = q.tasks.back();
+					q.tasks.pop_back();
+				}
+				else
+				{
+					t = q.tasks.front();
+					q.tasks.pop_front();
+				}
+				lock_guard<mutex> counted(mtx);
+				queued--;
+				return true;
+			}
+		}
+		return false;
+	}
+	//the owner of the batch may leave as soon as remaining is zero, so it is not touched after that
+	static void execute(task& t)
+	{
+		(*t.call)();
+		lock_guard<mutex> lock(t.owner->mtx);
+		if (--t.owner->remaining == 0)
+		{
+			t.owner->condition.notify_all();
+		}
+	}
+	void work(size_t th)
+	{
+		while (true)
+		{
+			task t;
+			if (take(th, t))
+			{
+				execute(t);
+				continue;
+			}
+			unique_lock<mutex> lock(mtx);
+			while (queued == 0 && !stopping)
+			{
+				condition.wait(lock);
+			}
+			if (queued == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	vector<taskQueue> queues;
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable condition;
+	size_t queued = 0;
+	size_t next = 0;
+	bool stopping = false;
+};
 
 class Solver {
+	//parts of a line of mapped articles file
 	class Article
 	{
 	public:
-		Article(string id, string title, string& words) :id_(id), title_(title),
+		Article(string_view id, string_view title, string_view words) :id_(id), title_(title),
 			words_(words) {};
-		string id_;
-		string title_;
-		string words_;
+		string_view id_;
+		string_view title_;
+		string_view words_;
 	};
 
-public:
-	using databaseIterator_t = list<Article>::iterator;
-	using dataItem_t = list < pair<int, databaseIterator_t>>;
-	using store_t = list<dataItem_t>;
-	using wordToArticleIndex_t = unordered_map<string, store_t::iterator>;
-	using sAndIt_t = vector<pair<string, dataItem_t::iterator>>;
-	using wordToIt_t = unordered_map<string, sAndIt_t::iterator>;
+	static constexpr uint32_t blockSize = 128;
+
+	static uint32_t readVarint(const uint8_t*& position)
+	{
+		uint32_t value = 0;
+		for (int shift = 0;; shift += 7)
+		{
+			uint8_t byte = *position++;
+			value |= uint32_t(byte & 0x7f) << shift;
+			if (byte < 0x80)
+			{
+				return value;
+			}
+		}
+	}
 
-	list<Article> mainData;
-	store_t store;
-	wordToArticleIndex_t wordToArticleIndex;
+	static void writeVarint(vector<uint8_t>& bytes, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			bytes.push_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		bytes.push_back(uint8_t(value));
+	}
+
+	/*Where a block of postings starts - its bytes, the article the first delta is relative to and its positions - and the last article in it.
+	The greatest frequency and the shortest article in the block bound score of any of its articles.*/
+	class skipEntry
+	{
+	public:
+		uint32_t last;
+		uint32_t base;
+		uint32_t offset;
+		uint32_t positions;
+		uint32_t maxFrequency;
+		uint32_t minLength;
+	};
 
+	/*Postings of one term - for every article containing the term its number (articles are numbered in order of reading), number of occurrences,
+	offset of the first one and size of their positions. All are varints and numbers of articles are stored as differences from the previous one,
+	so one posting takes four or five bytes. Positions (numbers of words in the article) are in a separate array, so that intersection does not
+	have to read them, they are varints again with differences from the previous one.
+	Every blockSize postings make a block, skips allow to jump over whole blocks without decoding them. List loaded from an index file only
+	points into its mapping until something is added to it.*/
+	class postingList
+	{
+	public:
+		//length is number of words of the article, positions are already encoded
+		void add(uint32_t article, uint32_t frequency, uint32_t offset, uint32_t length, const uint8_t* positionData, uint32_t positionLength)
+		{
+			own();
+			if (count % blockSize == 0)
+			{
+				skips.push_back({ article, lastArticle, uint32_t(bytes.size()), uint32_t(positions.size()), 0, UINT32_MAX });
+			}
+			skipEntry& skip = skips.back();
+			skip.last = article;
+			skip.maxFrequency = std::max(skip.maxFrequency, frequency);
+			skip.minLength = std::min(skip.minLength, length);
+			writeVarint(bytes, article - lastArticle);
+			writeVarint(bytes, frequency);
+			writeVarint(bytes, offset);
+			writeVarint(bytes, positionLength);
+			positions.insert(positions.end(), positionData, positionData + positionLength);
+			lastArticle = article;
+			count++;
+		}
+		//decodes one block into arrays of blockSize elements, returns number of postings in it
+		uint32_t decodeBlock(size_t block, uint32_t* articles, uint32_t* frequencies, uint32_t* offsets) const
+		{
+			const uint8_t* position = data() + skipData()[block].offset;
+			uint32_t article = skipData()[block].base;
+			uint32_t n = std::min<uint32_t>(blockSize, count - uint32_t(block) * blockSize);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				article += readVarint(position);
+				articles[i] = article;
+				frequencies[i] = readVarint(position);
+				offsets[i] = readVarint(position);
+				readVarint(position);
+			}
+			return n;
+		}
+		//appends postings of other list, all its articles have to follow the last one of this list
+		//articles of other are numbered from base in lengths
+		void append(const postingList& other, const vector<uint32_t>& lengths, uint32_t base)
+		{
+			for (postingCursor cursor(other); !cursor.atEnd(); cursor.next())
+			{
+				uint32_t article = base + cursor.article();
+				add(article, cursor.frequency(), cursor.offset(), lengths[article], cursor.encodedPositions(), cursor.encodedPositionLength());
+			}
+		}
+		void map(const uint8_t* bytes, uint32_t byteCount, const uint8_t* positions, uint32_t positionCount, const skipEntry* skips, uint32_t skipCount,
+			uint32_t count, uint32_t lastArticle)
+		{
+			mappedBytes = bytes;
+			mappedByteCount = byteCount;
+			mappedPositions = positions;
+			mappedPositionCount = positionCount;
+			mappedSkips = skips;
+			mappedSkipCount = skipCount;
+			this->count = count;
+			this->lastArticle = lastArticle;
+		}
+		//copies the mapped postings, so that the mapping can be released
+		void own()
+		{
+			if (mappedBytes != nullptr)
+			{
+				bytes.assign(mappedBytes, mappedBytes + mappedByteCount);
+				positions.assign(mappedPositions, mappedPositions + mappedPositionCount);
+				skips.assign(mappedSkips, mappedSkips + mappedSkipCount);
+				mappedBytes = nullptr;
+				mappedPositions = nullptr;
+				mappedSkips = nullptr;
+			}
+		}
+		const uint8_t* data() const
+		{
+			return mappedBytes != nullptr ? mappedBytes : bytes.data();
+		}
+		size_t byteCount() const
+		{
+			return mappedBytes != nullptr ? mappedByteCount : bytes.size();
+		}
+		const uint8_t* positionData() const
+		{
+			return mappedBytes != nullptr ? mappedPositions : positions.data();
+		}
+		size_t positionCount() const
+		{
+			return mappedBytes != nullptr ? mappedPositionCount : positions.size();
+		}
+		const skipEntry* skipData() const
+		{
+			return mappedBytes != nullptr ? mappedSkips : skips.data();
+		}
+		size_t skipCount() const
+		{
+			return mappedBytes != nullptr ? mappedSkipCount : skips.size();
+		}
+		uint32_t count = 0;
+		uint32_t lastArticle = 0;
+	private:
+		vector<uint8_t> bytes;
+		vector<uint8_t> positions;
+		vector<skipEntry> skips;
+		const uint8_t* mappedBytes = nullptr;
+		uint32_t mappedByteCount = 0;
+		const uint8_t* mappedPositions = nullptr;
+		uint32_t mappedPositionCount = 0;
+		const skipEntry* mappedSkips = nullptr;
+		uint32_t mappedSkipCount = 0;
+	};
 
-	void processOneLetter(char c, int charCount,string& cWord, unordered_set<string>& addedWords, databaseIterator_t newArticle)
+	//Decodes postingList from the beginning, article() and offset() are valid until atEnd()
+	class postingCursor
 	{
-		if (isalpha(c)) {
-			if (c >= 'A' && c <= 'Z')
+	public:
+		postingCursor(const postingList& list) :list(&list), position(list.data()), positionData(list.positionData()), remaining(list.count)
+		{
+			next();
+		}
+		bool atEnd() const
+		{
+			return finished;
+		}
+		uint32_t article() const
+		{
+			return currentArticle;
+		}
+		uint32_t offset() const
+		{
+			return currentOffset;
+		}
+		uint32_t frequency() const
+		{
+			return currentFrequency;
+		}
+		//positions of the term in the current article in ascending order
+		void positions(vector<uint32_t>& result) const
+		{
+			result.clear();
+			const uint8_t* p = positionData;
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < currentFrequency; i++)
+			{
+				value += readVarint(p);
+				result.push_back(value);
+			}
+		}
+		const uint8_t* encodedPositions() const
+		{
+			return positionData;
+		}
+		uint32_t encodedPositionLength() const
+		{
+			return positionLength;
+		}
+		uint32_t count() const
+		{
+			return list->count;
+		}
+		void next()
+		{
+			if (remaining == 0)
+			{
+				finished = true;
+				return;
+			}
+			remaining--;
+			positionData += positionLength;
+			currentArticle += readVarint(position);
+			currentFrequency = readVarint(position);
+			currentOffset = readVarint(position);
+			positionLength = readVarint(position);
+		}
+		//block which would contain target, found by galloping over last articles of blocks from the current one. Nullptr after the last block.
+		const skipEntry* findBlock(uint32_t target) const
+		{
+			const skipEntry* skips = list->skipData();
+			size_t skipCount = list->skipCount();
+			size_t block = (list->count - remaining - 1) / blockSize;
+			if (skips[block].last >= target)
+			{
+				return skips + block;
+			}
+			size_t low = block + 1;
+			size_t high = low;
+			size_t step = 1;
+			while (high < skipCount && skips[high].last < target)
+			{
+				low = high + 1;
+				high += step;
+				step *= 2;
+			}
+			high = std::min(high, skipCount);
+			const skipEntry* found = std::lower_bound(skips + low, skips + high, target,
+				[](const skipEntry& skip, uint32_t t) { return skip.last < t; });
+			return found == skips + skipCount ? nullptr : found;
+		}
+		//moves to the first article not less than target, only the block containing it is decoded
+		void advance(uint32_t target)
+		{
+			if (finished || currentArticle >= target)
+			{
+				return;
+			}
+			const skipEntry* skip = findBlock(target);
+			if (skip == nullptr)
+			{
+				finished = true;
+				return;
+			}
+			size_t block = skip - list->skipData();
+			if (block != (list->count - remaining - 1) / blockSize)
+			{
+				position = list->data() + skip->offset;
+				positionData = list->positionData() + skip->positions;
+				positionLength = 0;
+				currentArticle = skip->base;
+				remaining = list->count - uint32_t(block) * blockSize;
+				next();
+			}
+			while (currentArticle < target)
+			{
+				next();
+			}
+		}
+	private:
+		const postingList* list;
+		const uint8_t* position;
+		const uint8_t* positionData;
+		uint32_t positionLength = 0;
+		uint32_t remaining;
+		uint32_t currentArticle = 0;
+		uint32_t currentFrequency = 0;
+		uint32_t currentOffset = 0;
+		bool finished = false;
+	};
+
+	/*Intersection of two long lists - blocks are decoded into arrays and compared four by four articles with SIMD, blocks whose ranges
+	do not overlap are skipped. Calls found(article, offset in a) for every common article from first to last (exclusive).*/
+	template<typename Found>
+	static void intersectBlocks(const postingList& a, const postingList& b, uint32_t first, uint32_t last, Found&& found)
+	{
+		uint32_t articlesA[blockSize], frequencies[blockSize], offsetsA[blockSize], articlesB[blockSize], offsetsB[blockSize];
+		auto before = [](const skipEntry& skip, uint32_t article) { return skip.last < article; };
+		size_t blockA = std::lower_bound(a.skipData(), a.skipData() + a.skipCount(), first, before) - a.skipData();
+		size_t blockB = std::lower_bound(b.skipData(), b.skipData() + b.skipCount(), first, before) - b.skipData();
+		uint32_t i = 0, j = 0, na = 0, nb = 0;
+		auto common = [&](uint32_t article, uint32_t offset) {
+			if (article >= first && article < last)
+			{
+				found(article, offset);
+			}
+		};
+		while (true)
+		{
+			if (i == na)
+			{
+				while (blockA < a.skipCount() && j < nb && a.skipData()[blockA].last < articlesB[j])
+				{
+					blockA++;
+				}
+				//articles of the block follow its base
+				if (blockA == a.skipCount() || a.skipData()[blockA].base >= last)
+				{
+					return;
+				}
+				na = a.decodeBlock(blockA++, articlesA, frequencies, offsetsA);
+				i = 0;
+			}
+			if (j == nb)
+			{
+				while (blockB < b.skipCount() && b.skipData()[blockB].last < articlesA[i])
+				{
+					blockB++;
+				}
+				if (blockB == b.skipCount() || b.skipData()[blockB].base >= last)
+				{
+					return;
+				}
+				nb = b.decodeBlock(blockB++, articlesB, frequencies, offsetsB);
+				j = 0;
+			}
+#ifdef __SSE2__
+			while (i + 4 <= na && j + 4 <= nb)
+			{
+				__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(articlesA + i));
+				__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(articlesB + j));
+				__m128i equal = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+					_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+				int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+				for (int lane = 0; lane < 4; lane++)
+				{
+					if (mask & (1 << lane))
+					{
+						common(articlesA[i + lane], offsetsA[i + lane]);
+					}
+				}
+				uint32_t lastA = articlesA[i + 3];
+				uint32_t lastB = articlesB[j + 3];
+				if (lastA <= lastB)
+				{
+					i += 4;
+				}
+				if (lastB <= lastA)
+				{
+					j += 4;
+				}
+			}
+#endif
+			//the rest of the blocks one by one
+			while (i < na && j < nb)
+			{
+				if (articlesA[i] < articlesB[j])
+				{
+					i++;
+				}
+				else if (articlesB[j] < articlesA[i])
+				{
+					j++;
+				}
+				else
+				{
+					common(articlesA[i], offsetsA[i]);
+					i++;
+					j++;
+				}
+			}
+		}
+	}
+
+	/*Terms sorted by their bytes with their ids, front coded - terms make blocks of dictionaryBlock, the first term of a block is stored whole and
+	every other one only as the number of bytes it shares with the previous term and the rest. Term is found by binary search over the first
+	terms of blocks and a scan of one block, terms with a prefix are one range of the order. Like postingList, it is built in memory or points
+	into the mapping of an index file.*/
+	class termDictionary
+	{
+	public:
+		static constexpr size_t dictionaryBlock = 16;
+
+		bool find(string_view term, uint32_t& id) const
+		{
+			bool found = false;
+			scanFrom(findBlock(term), [&](string_view t, uint32_t i) {
+				int order = t.compare(term);
+				if (order == 0)
+				{
+					id = i;
+					found = true;
+				}
+				return order < 0;
+			});
+			return found;
+		}
+		//calls found(term, id) for all terms starting with prefix, in sorted order
+		template<typename Found>
+		void scan(string_view prefix, Found&& found) const
+		{
+			scanFrom(findBlock(prefix), [&](string_view t, uint32_t id) {
+				if (t.compare(0, prefix.size(), prefix) == 0)
+				{
+					found(t, id);
+					return true;
+				}
+				return t < prefix;
+			});
+		}
+		//adds terms which are not in the dictionary yet, the whole dictionary is encoded again
+		void insert(vector<pair<string_view, uint32_t>>& added)
+		{
+			std::sort(added.begin(), added.end());
+			termDictionary merged;
+			size_t next = 0;
+			scanFrom(0, [&](string_view term, uint32_t id) {
+				for (; next < added.size() && added[next].first < term; next++)
+				{
+					merged.push(added[next].first, added[next].second);
+				}
+				merged.push(term, id);
+				return true;
+			});
+			for (; next < added.size(); next++)
+			{
+				merged.push(added[next].first, added[next].second);
+			}
+			*this = std::move(merged);
+		}
+
+		void map(const uint8_t* bytes, uint64_t byteCount, const uint64_t* blocks, uint64_t blockCount, const uint32_t* ids, uint64_t count)
+		{
+			mappedBytes = bytes;
+			mappedByteCount = byteCount;
+			mappedBlocks = blocks;
+			mappedBlockCount = blockCount;
+			mappedIds = ids;
+			mappedCount = count;
+		}
+		void own()
+		{
+			if (mappedBytes != nullptr)
+			{
+				bytes.assign(mappedBytes, mappedBytes + mappedByteCount);
+				blocks.assign(mappedBlocks, mappedBlocks + mappedBlockCount);
+				ids.assign(mappedIds, mappedIds + mappedCount);
+				mappedBytes = nullptr;
+				mappedBlocks = nullptr;
+				mappedIds = nullptr;
+			}
+		}
+		const uint8_t* data() const
+		{
+			return mappedBytes != nullptr ? mappedBytes : bytes.data();
+		}
+		size_t byteCount() const
+		{
+			return mappedBytes != nullptr ? mappedByteCount : bytes.size();
+		}
+		const uint64_t* blockData() const
+		{
+			return mappedBytes != nullptr ? mappedBlocks : blocks.data();
+		}
+		size_t blockCount() const
+		{
+			return mappedBytes != nullptr ? mappedBlockCount : blocks.size();
+		}
+		//ids in the order of terms
+		const uint32_t* idData() const
+		{
+			return mappedBytes != nullptr ? mappedIds : ids.data();
+		}
+		size_t size() const
+		{
+			return mappedBytes != nullptr ? mappedCount : ids.size();
+		}
+	private:
+		//appends term, which follows all terms in the dictionary
+		void push(string_view term, uint32_t id)
+		{
+			size_t shared = 0;
+			if (ids.size() % dictionaryBlock == 0)
+			{
+				blocks.push_back(bytes.size());
+				writeVarint(bytes, uint32_t(term.size()));
+			}
+			else
+			{
+				size_t most = std::min(term.size(), last.size());
+				while (shared < most && term[shared] == last[shared])
+				{
+					shared++;
+				}
+				writeVarint(bytes, uint32_t(shared));
+				writeVarint(bytes, uint32_t(term.size() - shared));
+			}
+			bytes.insert(bytes.end(), term.begin() + shared, term.end());
+			ids.push_back(id);
+			last.assign(term.data(), term.size());
+		}
+		//last block whose first term is not greater than term
+		size_t findBlock(string_view term) const
+		{
+			size_t low = 0, high = blockCount();
+			while (low < high)
+			{
+				size_t middle = (low + high) / 2;
+				const uint8_t* position = data() + blockData()[middle];
+				uint32_t length = readVarint(position);
+				if (string_view(reinterpret_cast<const char*>(position), length) <= term)
+				{
+					low = middle + 1;
+				}
+				else
+				{
+					high = middle;
+				}
+			}
+			return low == 0 ? 0 : low - 1;
+		}
+		//decodes terms from the beginning of block while visit(term, id) returns true
+		template<typename Visit>
+		void scanFrom(size_t block, Visit&& visit) const
+		{
+			string term;
+			const uint8_t* position = nullptr;
+			for (size_t i = block * dictionaryBlock; i < size(); i++)
+			{
+				if (i % dictionaryBlock == 0)
+				{
+					position = data() + blockData()[i / dictionaryBlock];
+					term.clear();
+				}
+				else
+				{
+					term.resize(readVarint(position));
+				}
+				uint32_t length = readVarint(position);
+				term.append(reinterpret_cast<const char*>(position), length);
+				position += length;
+				if (!visit(string_view(term), idData()[i]))
+				{
+					return;
+				}
+			}
+		}
+
+		vector<uint8_t> bytes;
+		vector<uint64_t> blocks;
+		vector<uint32_t> ids;
+		string last;
+		const uint8_t* mappedBytes = nullptr;
+		uint64_t mappedByteCount = 0;
+		const uint64_t* mappedBlocks = nullptr;
+		uint64_t mappedBlockCount = 0;
+		const uint32_t* mappedIds = nullptr;
+		uint64_t mappedCount = 0;
+	};
+
+	//Articles of one chunk of the file and index of their words, built by one worker while the others build the other chunks
+	class partialIndex
+	{
+	public:
+		explicit partialIndex(bool utf8) :words(utf8) {}
+		//positions are collected in the arrays indexed by terms until the whole article is read
+		void addWord(string_view w, uint32_t offset, uint32_t position)
+		{
+			word.assign(w.data(), w.size());
+			auto existing = termIds.find(word);
+			if (existing == termIds.end())
+			{
+				existing = termIds.emplace(word, uint32_t(postings.size())).first;
+				postings.emplace_back();
+				positions.emplace_back();
+				firstOffsets.push_back(0);
+			}
+			uint32_t term = existing->second;
+			if (positions[term].empty())
+			{
+				firstOffsets[term] = offset;
+				touched.push_back(term);
+			}
+			positions[term].push_back(position);
+		}
+		void readWords(string_view text, uint32_t article)
+		{
+			uint32_t length = 0;
+			words(text, [&](string_view w, size_t offset) {
+				addWord(w, uint32_t(offset), length);
+				length++;
+			});
+			for (auto term : touched)
+			{
+				encoded.clear();
+				uint32_t previous = 0;
+				for (auto position : positions[term])
+				{
+					writeVarint(encoded, position - previous);
+					previous = position;
+				}
+				postings[term].add(article, uint32_t(positions[term].size()), firstOffsets[term], length, encoded.data(), uint32_t(encoded.size()));
+				positions[term].clear();
+			}
+			touched.clear();
+			lengths.push_back(length);
+		}
+		void build()
+		{
+			for (size_t k = 0; k < articles.size(); k++)
+			{
+				readWords(articles[k].words_, firstArticle + uint32_t(k));
+			}
+		}
+		uint32_t firstArticle = 0;
+		vector<Article> articles;
+		vector<uint32_t> lengths;
+		unordered_map<string, uint32_t> termIds;
+		vector<postingList> postings;
+	private:
+		tokenizer words;
+		string word;
+		vector<vector<uint32_t>> positions;
+		vector<uint8_t> encoded;
+		vector<uint32_t> firstOffsets;
+		vector<uint32_t> touched;
+	};
+
+	/*Index of consecutive articles of the file, they are numbered from 0 in every segment. Once it is published it does not change, so queries
+	read it without locks while new segments are indexed and merged. Segment loaded from an index file keeps its mapping.*/
+	class segment
+	{
+	public:
+		vector<Article> articles;
+		vector<uint32_t> lengths;
+		uint64_t totalLength = 0;
+		termDictionary dictionary;
+		vector<postingList> postings;
+		unique_ptr<mappedFile> index;
+		//mapping of the articles file which the articles point into, it is released with the last segment using it
+		shared_ptr<const mappedFile> source;
+		//part of the articles file which the articles were read from, its index file covers the same part
+		uint64_t sourceStart = 0;
+		uint64_t sourceEnd = 0;
+	};
+
+	static constexpr size_t chunkArticles = 1024;
+
+	//calls append(term) for terms from 0 to count, every one of thrs threads takes every thrs-th term
+	template<typename Append>
+	static void forTerms(size_t count, size_t thrs, Append&& append)
+	{
+		vector<thread> workers;
+		for (size_t th = 0; th < thrs; th++)
+		{
+			workers.emplace_back([&, th]()
+				{
+					for (size_t term = th; term < count; term += thrs)
+					{
+						append(term);
+					}
+				});
+		}
+		for (auto&& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	//appends chunks in order of the file to segment s. Terms get their ids serially, postings of different terms are then concatenated in parallel.
+	void merge(vector<unique_ptr<partialIndex>>& chunks, size_t thrs, segment& s)
+	{
+		vector<vector<pair<uint32_t, uint32_t>>> sources(s.postings.size());
+		//new terms get ids in a hash table first, the dictionary is encoded again once at the end
+		vector<pair<string_view, uint32_t>> added;
+		unordered_map<string_view, uint32_t> addedIds;
+		for (uint32_t c = 0; c < chunks.size(); c++)
+		{
+			partialIndex& chunk = *chunks[c];
+			s.articles.insert(s.articles.end(), make_move_iterator(chunk.articles.begin()), make_move_iterator(chunk.articles.end()));
+			s.lengths.insert(s.lengths.end(), chunk.lengths.begin(), chunk.lengths.end());
+			for (auto length : chunk.lengths)
+			{
+				s.totalLength += length;
+			}
+			for (auto&& term : chunk.termIds)
+			{
+				uint32_t id;
+				auto existing = addedIds.find(term.first);
+				if (existing != addedIds.end())
+				{
+					id = existing->second;
+				}
+				else if (!s.dictionary.find(term.first, id))
+				{
+					id = uint32_t(sources.size());
+					sources.emplace_back();
+					addedIds.emplace(term.first, id);
+					added.push_back({ term.first, id });
+				}
+				sources[id].push_back({ c, term.second });
+			}
+		}
+		s.dictionary.insert(added);
+		s.postings.resize(sources.size());
+		forTerms(sources.size(), thrs, [&](size_t term) {
+			for (auto&& source : sources[term])
+			{
+				s.postings[term].append(chunks[source.first]->postings[source.second], s.lengths, 0);
+			}
+		});
+	}
+
+	/*joins adjacent segments into one, articles of every part follow those of the previous ones. The file only grows, so the mapping of the last
+	part has articles of all of them and the merged articles point into it - older mappings are released once no segment uses them.*/
+	shared_ptr<segment> mergeSegments(const vector<shared_ptr<const segment>>& parts, size_t thrs)
+	{
+		auto merged = make_shared<segment>();
+		merged->source = parts.back()->source;
+		merged->sourceStart = parts.front()->sourceStart;
+		merged->sourceEnd = parts.back()->sourceEnd;
+		string_view target = merged->source->view();
+		auto moved = [&](const segment& part, string_view text) {
+			return part.source == merged->source ? text : target.substr(fileOffset(part, text.data()), text.size());
+		};
+		vector<uint32_t> bases;
+		unordered_map<string, uint32_t> ids;
+		vector<vector<pair<uint32_t, uint32_t>>> sources;
+		for (uint32_t p = 0; p < parts.size(); p++)
+		{
+			const segment& part = *parts[p];
+			bases.push_back(uint32_t(merged->articles.size()));
+			for (auto&& article : part.articles)
+			{
+				merged->articles.push_back(Article{ moved(part, article.id_), moved(part, article.title_), moved(part, article.words_) });
+			}
+			merged->lengths.insert(merged->lengths.end(), part.lengths.begin(), part.lengths.end());
+			merged->totalLength += part.totalLength;
+			part.dictionary.scan("", [&](string_view term, uint32_t id) {
+				auto existing = ids.emplace(string(term), uint32_t(sources.size())).first;
+				if (existing->second == sources.size())
+				{
+					sources.emplace_back();
+				}
+				sources[existing->second].push_back({ p, id });
+			});
+		}
+		vector<pair<string_view, uint32_t>> added;
+		added.reserve(ids.size());
+		for (auto&& term : ids)
+		{
+			added.push_back({ term.first, term.second });
+		}
+		merged->dictionary.insert(added);
+		merged->postings.resize(sources.size());
+		forTerms(sources.size(), thrs, [&](size_t term) {
+			for (auto&& source : sources[term])
+			{
+				merged->postings[term].append(parts[source.first]->postings[source.second], merged->lengths, bases[source.first]);
+			}
+		});
+		return merged;
+	}
+
+	/*Indexes articles of mapped file starting at position into segment s, returns where their list ended - past the blank line which terminates
+	it, so that articles appended after the terminator are read from there. This thread splits them into chunks
+	of articles, thrs workers index them into partial indexes and at the end they are merged.*/
+	size_t indexArticles(string_view data, size_t position, size_t thrs, segment& s)
+	{
+		//lines of files written on Windows end with \r\n, the \r is not a part of them
+		auto getLine = [&]() {
+			size_t end = std::min(data.find('\n', position), data.size());
+			string_view line = position < data.size() ? data.substr(position, end - position) : string_view();
+			position = end + 1;
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.remove_suffix(1);
+			}
+			return line;
+		};
+
+		thrs = std::max<size_t>(thrs, 1);
+		vector<unique_ptr<partialIndex>> chunks;
+		queue<partialIndex*> work;
+		mutex mtx;
+		condition_variable condition;
+		bool reading = true;
+
+		vector<thread> workers;
+		for (size_t th = 0; th < thrs; th++)
+		{
+			workers.emplace_back([&]()
+				{
+					while (true)
+					{
+						partialIndex* chunk;
+						{
+							unique_lock<mutex> lock(mtx);
+							while (work.empty() && reading)
+							{
+								condition.wait(lock);
+							}
+							if (work.empty())
+							{
+								return;
+							}
+							chunk = work.front();
+							work.pop();
+						}
+						condition.notify_all();
+						chunk->build();
+					}
+				});
+		}
+		//at most two chunks per worker wait, so that the reader does not run far ahead
+		auto submit = [&](partialIndex* chunk) {
+			unique_lock<mutex> lock(mtx);
+			while (work.size() >= 2 * thrs)
+			{
+				condition.wait(lock);
+			}
+			work.push(chunk);
+			condition.notify_all();
+		};
+
+		uint32_t nextArticle = uint32_t(s.articles.size());
+		string_view line = getLine();
+		while (line != "")
+		{
+			if (chunks.empty() || chunks.back()->articles.size() == chunkArticles)
+			{
+				if (!chunks.empty())
+				{
+					submit(chunks.back().get());
+				}
+				chunks.push_back(make_unique<partialIndex>(utf8));
+				chunks.back()->firstArticle = nextArticle;
+			}
+			string_view currID = line;
+			string_view currTitle = getLine();
+			chunks.back()->articles.push_back(Article{ currID,currTitle,getLine() });
+			nextArticle++;
+			line = getLine();
+		}
+		if (!chunks.empty())
+		{
+			submit(chunks.back().get());
+		}
+		{
+			lock_guard<mutex> lock(mtx);
+			reading = false;
+		}
+		condition.notify_all();
+		for (auto&& worker : workers)
+		{
+			worker.join();
+		}
+		merge(chunks, thrs, s);
+		return std::min(position, data.size());
+	}
+
+	static constexpr uint32_t indexVersion = 6;
+
+	/*Index file starts with this header, then follow articles, terms, skips of all postings, names of terms, postings and positions. Numbers are
+	in byte order of the machine which wrote it. Source is the part of articles file which was indexed - from the start for the index itself,
+	from the end of the previous one for a segment file. The tail of the file up to its end is checked to catch rewrites.*/
+	class indexHeader
+	{
+	public:
+		char magic[4];
+		uint32_t version;
+		uint64_t checksum;
+		uint64_t sourceStart;
+		uint64_t sourceSize;
+		uint64_t sourceTail;
+		uint64_t articleCount;
+		uint64_t termCount;
+		uint64_t skipCount;
+		uint64_t dictionaryBlocks;
+		uint64_t dictionarySize;
+		uint64_t postingsSize;
+		uint64_t positionsSize;
+		uint64_t flags;
+	};
+	class storedArticle
+	{
+	public:
+		uint64_t start;
+		uint32_t idLength;
+		uint32_t titleLength;
+		uint32_t textLength;
+		uint32_t length;
+	};
+	class storedTerm
+	{
+	public:
+		uint64_t postings;
+		uint64_t skips;
+		uint64_t positions;
+		uint32_t postingsLength;
+		uint32_t skipCount;
+		uint32_t count;
+		uint32_t lastArticle;
+		uint32_t positionsLength;
+	};
+
+	//options which change the index, it has to be rebuilt when they differ
+	uint64_t indexFlags() const
+	{
+		return utf8 ? 1 : 0;
+	}
+
+	//64 bit hash of data, eight bytes at a time
+	static uint64_t checksum(const char* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull ^ size;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * 0x100000001b3ull;
+			hash ^= hash >> 29;
+		}
+		for (; i < size; i++)
+		{
+			hash = (hash ^ uint8_t(data[i])) * 0x100000001b3ull;
+		}
+		return hash;
+	}
+	static uint64_t sourceTail(string_view source, size_t size)
+	{
+		size_t length = std::min<size_t>(size, 4096);
+		return checksum(source.data() + size - length, length);
+	}
+
+	//articles appended while following are kept in segment files named by where their part of the articles file starts, the first one is the index
+	static string segmentFile(const string& indexFile, uint64_t start)
+	{
+		return start == 0 ? indexFile : indexFile + "." + to_string(start);
+	}
+
+	//loads index of the articles file from start if it is valid and matches the file, postings stay in the mapping
+	shared_ptr<segment> loadIndex(const string& indexFile, uint64_t start, shared_ptr<const mappedFile> articles)
+	{
+		auto index = make_unique<mappedFile>(indexFile);
+		string_view data = index->view();
+		indexHeader header;
+		if (data.size() < sizeof(header))
+		{
+			return nullptr;
+		}
+		memcpy(&header, data.data(), sizeof(header));
+		if (memcmp(header.magic, "FTIX", 4) != 0 || header.version != indexVersion || header.flags != indexFlags())
+		{
+			return nullptr;
+		}
+		uint64_t expected = sizeof(header) + header.articleCount * sizeof(storedArticle) + header.termCount * sizeof(storedTerm)
+			+ header.skipCount * sizeof(skipEntry) + header.dictionaryBlocks * sizeof(uint64_t) + header.termCount * sizeof(uint32_t) + header.dictionarySize
+			+ header.postingsSize + header.positionsSize;
+		if (expected != data.size() || checksum(data.data() + sizeof(header), data.size() - sizeof(header)) != header.checksum)
+		{
+			return nullptr;
+		}
+		string_view source = articles->view();
+		if (header.sourceStart != start || header.sourceSize > source.size() || sourceTail(source, header.sourceSize) != header.sourceTail)
+		{
+			return nullptr;
+		}
+
+		const char* position = data.data() + sizeof(header);
+		auto stored = reinterpret_cast<const storedArticle*>(position);
+		position += header.articleCount * sizeof(storedArticle);
+		auto terms = reinterpret_cast<const storedTerm*>(position);
+		position += header.termCount * sizeof(storedTerm);
+		auto skips = reinterpret_cast<const skipEntry*>(position);
+		position += header.skipCount * sizeof(skipEntry);
+		auto blocks = reinterpret_cast<const uint64_t*>(position);
+		position += header.dictionaryBlocks * sizeof(uint64_t);
+		auto ids = reinterpret_cast<const uint32_t*>(position);
+		position += header.termCount * sizeof(uint32_t);
+		auto names = reinterpret_cast<const uint8_t*>(position);
+		auto bytes = names + header.dictionarySize;
+		const uint8_t* positions = bytes + header.postingsSize;
+
+		auto s = make_shared<segment>();
+		s->articles.reserve(header.articleCount);
+		for (uint64_t a = 0; a < header.articleCount; a++)
+		{
+			const storedArticle& article = stored[a];
+			//lines may end with \r\n
+			auto nextLine = [&](uint64_t end) { return end + (end < source.size() && source[end] == '\r' ? 2 : 1); };
+			string_view id = source.substr(article.start, article.idLength);
+			uint64_t titleStart = nextLine(article.start + article.idLength);
+			string_view title = source.substr(titleStart, article.titleLength);
+			s->articles.push_back(Article{ id, title, source.substr(nextLine(titleStart + article.titleLength), article.textLength) });
+			s->lengths.push_back(article.length);
+			s->totalLength += article.length;
+		}
+		s->dictionary.map(names, header.dictionarySize, blocks, header.dictionaryBlocks, ids, header.termCount);
+		s->postings.resize(header.termCount);
+		for (uint32_t t = 0; t < header.termCount; t++)
+		{
+			const storedTerm& term = terms[t];
+			s->postings[t].map(bytes + term.postings, term.postingsLength, positions + term.positions, term.positionsLength, skips + term.skips, term.skipCount,
+				term.count, term.lastArticle);
+		}
+		indexedSize = header.sourceSize;
+		s->sourceStart = header.sourceStart;
+		s->sourceEnd = header.sourceSize;
+		s->index = std::move(index);
+		s->source = std::move(articles);
+		return s;
+	}
+
+	//where in the articles file is the text of an article of segment s
+	static uint64_t fileOffset(const segment& s, const char* text)
+	{
+		return uint64_t(text - s.source->view().data());
+	}
+
+	//writes segment s with all articles into a temporary file, which then replaces indexFile. s must not point into the mapping of indexFile.
+	bool writeIndex(const segment& s, const string& indexFile)
+	{
+		string_view source = s.source->view();
+		indexHeader header;
+		memcpy(header.magic, "FTIX", 4);
+		header.version = indexVersion;
+		header.sourceStart = s.sourceStart;
+		header.sourceSize = s.sourceEnd;
+		header.sourceTail = sourceTail(source, s.sourceEnd);
+		header.articleCount = s.articles.size();
+		header.termCount = s.postings.size();
+		header.skipCount = 0;
+		header.dictionaryBlocks = s.dictionary.blockCount();
+		header.dictionarySize = s.dictionary.byteCount();
+		header.postingsSize = 0;
+		header.positionsSize = 0;
+		header.flags = indexFlags();
+
+		vector<storedArticle> stored;
+		stored.reserve(s.articles.size());
+		for (size_t a = 0; a < s.articles.size(); a++)
+		{
+			const Article& article = s.articles[a];
+			stored.push_back({ fileOffset(s, article.id_.data()), uint32_t(article.id_.size()), uint32_t(article.title_.size()),
+				uint32_t(article.words_.size()), s.lengths[a] });
+		}
+		vector<storedTerm> terms(s.postings.size());
+		for (size_t term = 0; term < s.postings.size(); term++)
+		{
+			storedTerm& t = terms[term];
+			const postingList& list = s.postings[term];
+			t.postingsLength = uint32_t(list.byteCount());
+			t.skipCount = uint32_t(list.skipCount());
+			t.count = list.count;
+			t.lastArticle = list.lastArticle;
+			t.positionsLength = uint32_t(list.positionCount());
+		}
+		for (auto&& t : terms)
+		{
+			t.postings = header.postingsSize;
+			t.skips = header.skipCount;
+			t.positions = header.positionsSize;
+			header.positionsSize += t.positionsLength;
+			header.postingsSize += t.postingsLength;
+			header.skipCount += t.skipCount;
+		}
+
+		string body;
+		body.reserve(stored.size() * sizeof(storedArticle) + terms.size() * sizeof(storedTerm) + header.skipCount * sizeof(skipEntry)
+			+ header.dictionaryBlocks * sizeof(uint64_t) + header.termCount * sizeof(uint32_t) + header.dictionarySize + header.postingsSize + header.positionsSize);
+		body.append(reinterpret_cast<const char*>(stored.data()), stored.size() * sizeof(storedArticle));
+		body.append(reinterpret_cast<const char*>(terms.data()), terms.size() * sizeof(storedTerm));
+		for (auto&& list : s.postings)
+		{
+			body.append(reinterpret_cast<const char*>(list.skipData()), list.skipCount() * sizeof(skipEntry));
+		}
+		body.append(reinterpret_cast<const char*>(s.dictionary.blockData()), s.dictionary.blockCount() * sizeof(uint64_t));
+		body.append(reinterpret_cast<const char*>(s.dictionary.idData()), s.dictionary.size() * sizeof(uint32_t));
+		body.append(reinterpret_cast<const char*>(s.dictionary.data()), s.dictionary.byteCount());
+		for (auto&& list : s.postings)
+		{
+			body.append(reinterpret_cast<const char*>(list.data()), list.byteCount());
+		}
+		for (auto&& list : s.postings)
+		{
+			body.append(reinterpret_cast<const char*>(list.positionData()), list.positionCount());
+		}
+		header.checksum = checksum(body.data(), body.size());
+
+		string temporary = indexFile + ".tmp";
+		{
+			ofstream out(temporary, ios::binary | ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(body.data(), body.size());
+			out.close();
+			if (!out)
+			{
+				remove(temporary.c_str());
+				return false;
+			}
+		}
+		//the old index is replaced at once, a reader or a crash never finds it missing
+#ifdef _WIN32
+		bool replaced = MoveFileExA(temporary.c_str(), indexFile.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		bool replaced = rename(temporary.c_str(), indexFile.c_str()) == 0;
+#endif
+		if (!replaced)
+		{
+			remove(temporary.c_str());
+		}
+		return replaced;
+	}
+
+	//writes a segment of follow into its segment file next to the index of openIndex, so that its articles are not read again after a restart
+	bool persistSegment(const segment& s)
+	{
+		if (persistedIndex.empty())
+		{
+			return true;
+		}
+		string file = segmentFile(persistedIndex, s.sourceStart);
+		if (!writeIndex(s, file))
+		{
+			cerr << "Cannot write " << file << endl;
+			return false;
+		}
+		return true;
+	}
+
+	//segments in the order of articles and totals over them. Snapshot is replaced as a whole, so a query keeps the one it started with.
+	class snapshot
+	{
+	public:
+		vector<shared_ptr<const segment>> segments;
+		//grows whenever articles are added, answers of different generations are cached apart
+		uint64_t generation = 0;
+		uint64_t articleCount = 0;
+		uint64_t totalLength = 0;
+	};
+	shared_ptr<const snapshot> published = make_shared<snapshot>();
+	mutex publishMutex;
+
+	//adds segment of new articles after the others, the next query finds them
+	void addSegment(shared_ptr<const segment> s)
+	{
+		{
+			lock_guard<mutex> lock(publishMutex);
+			auto next = make_shared<snapshot>(*published);
+			next->articleCount += s->articles.size();
+			next->totalLength += s->totalLength;
+			next->generation++;
+			next->segments.push_back(std::move(s));
+			published = std::move(next);
+		}
+		cache.clear();
+		//the merger either sees the new snapshot or already waits
+		{
+			lock_guard<mutex> lock(followMutex);
+		}
+		mergeCondition.notify_all();
+	}
+	//replaces count segments from first by one with the same articles, only the merger removes segments so their positions hold
+	void replaceSegments(size_t first, size_t count, shared_ptr<const segment> merged)
+	{
+		lock_guard<mutex> lock(publishMutex);
+		auto next = make_shared<snapshot>(*published);
+		next->segments.erase(next->segments.begin() + first, next->segments.begin() + first + count);
+		next->segments.insert(next->segments.begin() + first, std::move(merged));
+		published = std::move(next);
+	}
+
+	static constexpr size_t mergeFactor = 4;
+	//segments of the next tier have mergeFactor times more articles
+	static size_t tier(const segment& s)
+	{
+		size_t t = 0;
+		for (size_t n = chunkArticles; n < s.articles.size(); n *= mergeFactor)
+		{
+			t++;
+		}
+		return t;
+	}
+	//first of mergeFactor adjacent segments of the same tier, SIZE_MAX when there are none
+	static size_t findMerge(const vector<shared_ptr<const segment>>& segments)
+	{
+		for (size_t first = 0; first + mergeFactor <= segments.size(); first++)
+		{
+			size_t k = 1;
+			while (k < mergeFactor && tier(*segments[first + k]) == tier(*segments[first]))
+			{
+				k++;
+			}
+			if (k == mergeFactor)
+			{
+				return first;
+			}
+		}
+		return SIZE_MAX;
+	}
+
+	//indexes whole articles appended after the indexed part of the file as a new segment
+	void readAppended(const string& articlesFile)
+	{
+		auto mapping = make_shared<const mappedFile>(articlesFile);
+		string_view data = mapping->view();
+		//the file is still there but it cannot be mapped, e.g. when the process has too many mappings
+		if (data.size() < indexedSize)
+		{
+			if (!mappingFailed)
+			{
+				cerr << "Cannot map " << articlesFile << ", appended articles are not read" << endl;
+			}
+			mappingFailed = true;
+			return;
+		}
+		mappingFailed = false;
+		//an article may be still being written, only groups of three whole lines are read
+		size_t complete = indexedSize, lines = 0;
+		for (size_t end = data.find('\n', indexedSize); end != string_view::npos; end = data.find('\n', end + 1))
+		{
+			if (++lines % 3 == 0)
+			{
+				complete = end + 1;
+			}
+		}
+		if (complete == indexedSize)
+		{
+			return;
+		}
+		auto s = make_shared<segment>();
+		//blank lines only move the indexed part past them, the segment starts where the previous one ended
+		shared_ptr<const snapshot> index = current();
+		s->sourceStart = index->segments.empty() ? 0 : index->segments.back()->sourceEnd;
+		indexedSize = indexArticles(data.substr(0, complete), indexedSize, 1, *s);
+		s->sourceEnd = indexedSize;
+		if (s->articles.empty())
+		{
+			return;
+		}
+		s->source = std::move(mapping);
+		persistSegment(*s);
+		addSegment(std::move(s));
+	}
+
+	//articles from first to last (exclusive) of one segment of a snapshot
+	class shardPart
+	{
+	public:
+		size_t segment;
+		uint32_t first;
+		uint32_t last;
+	};
+	/*splits articles of all segments in their order into shards of about the same number of articles, a shard has parts of the segments it
+	spans. Shards smaller than a chunk are not worth a task.*/
+	vector<vector<shardPart>> splitShards(const snapshot& index) const
+	{
+		uint64_t perShard = std::max<uint64_t>((index.articleCount + shardCount - 1) / shardCount, chunkArticles);
+		vector<vector<shardPart>> shards(1);
+		uint64_t filled = 0;
+		for (size_t i = 0; i < index.segments.size(); i++)
+		{
+			uint32_t size = uint32_t(index.segments[i]->articles.size());
+			for (uint32_t first = 0; first < size;)
+			{
+				if (filled == perShard)
+				{
+					shards.emplace_back();
+					filled = 0;
+				}
+				uint32_t last = uint32_t(std::min<uint64_t>(size, first + perShard - filled));
+				shards.back().push_back({ i, first, last });
+				filled += last - first;
+				first = last;
+			}
+		}
+		return shards;
+	}
+	//calls task(k) for every shard k, on the pool when there is more of them
+	template<typename Task>
+	void forShards(size_t count, Task&& task)
+	{
+		if (count == 1 || !pool)
+		{
+			for (size_t k = 0; k < count; k++)
+			{
+				task(k);
+			}
+			return;
+		}
+		vector<function<void()>> tasks;
+		for (size_t k = 0; k < count; k++)
+		{
+			tasks.push_back([&task, k]() { task(k); });
+		}
+		pool->run(tasks);
+	}
+	//every shard prints into its own buffer by answer(out, k) and the buffers are printed in order of shards
+	template<typename Answer>
+	void printShards(ostream& out, size_t count, Answer&& answer)
+	{
+		if (count == 1 || !pool)
+		{
+			forShards(count, [&](size_t k) { answer(out, k); });
+			return;
+		}
+		vector<ostringstream> buffers(count);
+		forShards(count, [&](size_t k) { answer(buffers[k], k); });
+		for (auto&& buffer : buffers)
+		{
+			out << buffer.str();
+		}
+	}
+	size_t shardCount = 1;
+	unique_ptr<workStealingPool> pool;
+
+	vector<thread> followers;
+	mutex followMutex;
+	condition_variable followCondition;
+	condition_variable mergeCondition;
+	bool following = false;
+	bool mappingFailed = false;
+	//index opened by openIndex, segments of follow are written next to it
+	string persistedIndex;
+
+public:
+	size_t indexedSize = 0;
+	//when it is not zero, queries print this many best articles by BM25 instead of all articles containing all terms
+	size_t rankedResults = 0;
+	resultCache cache;
+	//words may contain bytes of UTF-8 characters, otherwise only ASCII letters
+	bool utf8 = false;
+
+	~Solver()
+	{
+		stopFollowing();
+	}
+
+	shared_ptr<const snapshot> current()
+	{
+		lock_guard<mutex> lock(publishMutex);
+		return published;
+	}
+
+	/*Splits articles into count shards, every query is answered on all of them at once by thrs threads and their answers are joined. Shards are
+	ranges of articles of the segments, so they need no index of their own and follow the segments as they are added and merged.*/
+	void shardQueries(size_t count, size_t thrs)
+	{
+		shardCount = std::max<size_t>(count, 1);
+		pool = shardCount > 1 ? make_unique<workStealingPool>(thrs) : nullptr;
+	}
+
+	//bytes taken by the index of all segments - articles, postings with their positions and skips and the dictionary, not the articles file
+	uint64_t indexBytes()
+	{
+		uint64_t bytes = 0;
+		for (auto&& s : current()->segments)
+		{
+			bytes += s->articles.size() * sizeof(Article) + s->lengths.size() * sizeof(uint32_t) + s->postings.size() * sizeof(postingList);
+			bytes += s->dictionary.byteCount() + s->dictionary.blockCount() * sizeof(uint64_t) + s->dictionary.size() * sizeof(uint32_t);
+			for (auto&& list : s->postings)
+			{
+				bytes += list.byteCount() + list.positionCount() + list.skipCount() * sizeof(skipEntry);
+			}
+		}
+		return bytes;
+	}
+
+	void readArticles(string& articlesFile, size_t thrs = thread::hardware_concurrency())
+	{
+		auto s = make_shared<segment>();
+		s->source = make_shared<const mappedFile>(articlesFile);
+		indexedSize = indexArticles(s->source->view(), 0, thrs, *s);
+		s->sourceEnd = indexedSize;
+		addSegment(std::move(s));
+	}
+
+	/*Opens articles together with their index stored in indexFile and the segment files which follow wrote after it. When they match the articles
+	they are used as they are, only articles appended after the indexed part are read and then all are written again as one index. Without a valid
+	index all articles are read and it is written. Segments of a later follow are written next to it.*/
+	void openIndex(string& articlesFile, string& indexFile, size_t thrs = thread::hardware_concurrency())
+	{
+		auto articles = make_shared<const mappedFile>(articlesFile);
+		//every segment file starts where the previous one ended
+		vector<shared_ptr<const segment>> loaded;
+		for (auto s = loadIndex(indexFile, 0, articles); s; s = loadIndex(segmentFile(indexFile, indexedSize), indexedSize, articles))
+		{
+			loaded.push_back(std::move(s));
+		}
+		persistedIndex = indexFile;
+		auto appended = make_shared<segment>();
+		appended->source = articles;
+		appended->sourceStart = indexedSize;
+		//articles may be appended after the blank line which ended the list, as follow reads them
+		for (size_t from = SIZE_MAX; indexedSize != from && indexedSize < articles->view().size();)
+		{
+			from = indexedSize;
+			indexedSize = indexArticles(articles->view(), indexedSize, thrs, *appended);
+		}
+		appended->sourceEnd = indexedSize;
+		if (!loaded.empty() && appended->articles.empty())
+		{
+			for (auto&& s : loaded)
+			{
+				addSegment(std::move(s));
+			}
+			return;
+		}
+		//the merged segment does not point into the old index files, which are released before they are replaced
+		vector<uint64_t> starts;
+		for (auto&& s : loaded)
+		{
+			starts.push_back(s->sourceStart);
+		}
+		loaded.push_back(appended);
+		shared_ptr<const segment> whole = loaded.size() > 1 ? mergeSegments(loaded, thrs) : appended;
+		loaded.clear();
+		if (writeIndex(*whole, indexFile))
+		{
+			for (auto start : starts)
+			{
+				if (start != 0)
+				{
+					remove(segmentFile(indexFile, start).c_str());
+				}
+			}
+		}
+		else
+		{
+			cerr << "Cannot write " << indexFile << endl;
+		}
+		addSegment(std::move(whole));
+	}
+
+	/*Indexes articles appended to articlesFile every interval into a new segment, which is searched as soon as it is added. Merger thread joins
+	mergeFactor adjacent segments of the same tier into one of the next tier, so there stay few segments and old articles are not indexed again.*/
+	void follow(const string& articlesFile, chrono::milliseconds interval)
+	{
+		following = true;
+		followers.emplace_back([this, articlesFile, interval]()
+			{
+				unique_lock<mutex> lock(followMutex);
+				while (following)
+				{
+					followCondition.wait_for(lock, interval);
+					if (following)
+					{
+						lock.unlock();
+						readAppended(articlesFile);
+						lock.lock();
+					}
+				}
+			});
+		followers.emplace_back([this]()
+			{
+				unique_lock<mutex> lock(followMutex);
+				while (following)
+				{
+					shared_ptr<const snapshot> segments = current();
+					size_t first = findMerge(segments->segments);
+					if (first == SIZE_MAX)
+					{
+						mergeCondition.wait(lock);
+						continue;
+					}
+					lock.unlock();
+					vector<shared_ptr<const segment>> parts(segments->segments.begin() + first, segments->segments.begin() + first + mergeFactor);
+					shared_ptr<const segment> merged = mergeSegments(parts, 1);
+					//the merged segment replaces the file of the first part, files of the others are removed only then
+					if (!persistedIndex.empty() && persistSegment(*merged))
+					{
+						for (size_t p = 1; p < parts.size(); p++)
+						{
+							remove(segmentFile(persistedIndex, parts[p]->sourceStart).c_str());
+						}
+					}
+					replaceSegments(first, mergeFactor, std::move(merged));
+					lock.lock();
+				}
+			});
+	}
+	void stopFollowing()
+	{
+		{
+			lock_guard<mutex> lock(followMutex);
+			following = false;
+		}
+		followCondition.notify_all();
+		mergeCondition.notify_all();
+		for (auto&& follower : followers)
+		{
+			follower.join();
+		}
+		followers.clear();
+	}
+
+	void printArticle(ostream& out, const segment& s, uint32_t article, uint32_t offset)
+	{
+		out << "[" << s.articles[article].id_ << "]" << " " << s.articles[article].title_ << '\n';
+		out << s.articles[article].words_.substr(offset, 75) << "..." << '\n';
+	}
+	void find(string word)
+	{
+		for (auto&& s : current()->segments)
+		{
+			uint32_t term;
+			if (s->dictionary.find(word, term))
+			{
+				for (postingCursor cursor(s->postings[term]); !cursor.atEnd(); cursor.next())
+				{
+					printArticle(cout, *s, cursor.article(), cursor.offset());
+				}
+			}
+		}
+	}
+	//searched terms from first to last (exclusive) have to be next to each other in this order, or within distance words in any order
+	class phraseGroup
+	{
+	public:
+		size_t first;
+		size_t last;
+		uint32_t distance;
+	};
+
+	//words of a query with * (any characters) or ? (one character) are patterns, which stand for all matching terms
+	class expansion
+	{
+	public:
+		vector<string> patterns;
+		vector<postingList> lists;
+	};
+	//lists of patterns have ids after the terms of the index
+	const postingList& list(const segment& s, uint32_t term, const expansion& expanded) const
+	{
+		return term < s.postings.size() ? s.postings[term] : expanded.lists[term - s.postings.size()];
+	}
+	/*when the word from start to end touches * or ?, extends them over the whole pattern and returns it lowercased. ? ends questions too,
+	so it is a wildcard only when a letter or another wildcard follows it.*/
+	bool readPattern(string_view line, size_t& start, size_t& end, string& pattern) const
+	{
+		auto letter = [&](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (utf8 && (unsigned char)c >= 0x80); };
+		auto wildcard = [&](size_t i) {
+			size_t next = i;
+			while (next < line.size() && line[next] == '?')
+			{
+				next++;
+			}
+			return line[i] == '*' || (next > i && next < line.size() && (letter(line[next]) || line[next] == '*'));
+		};
+		if (!(start > 0 && wildcard(start - 1)) && !(end < line.size() && wildcard(end)))
+		{
+			return false;
+		}
+		auto inPattern = [&](size_t i) { return wildcard(i) || letter(line[i]); };
+		while (start > 0 && inPattern(start - 1))
+		{
+			start--;
+		}
+		while (end < line.size() && inPattern(end))
+		{
+			end++;
+		}
+		pattern.clear();
+		for (size_t i = start; i < end; i++)
+		{
+			pattern += line[i] >= 'A' && line[i] <= 'Z' ? char(line[i] + 'a' - 'A') : line[i];
+		}
+		return true;
+	}
+	//in UTF-8 mode ? matches a character with all its bytes. * goes back to the last star and takes one more character.
+	bool matchPattern(string_view pattern, string_view term) const
+	{
+		auto character = [&](size_t t) {
+			size_t n = 1;
+			while (utf8 && t + n < term.size() && (term[t + n] & 0xc0) == 0x80)
+			{
+				n++;
+			}
+			return n;
+		};
+		size_t p = 0, t = 0, star = string_view::npos, starTerm = 0;
+		while (t < term.size())
+		{
+			if (p < pattern.size() && pattern[p] == '*')
+			{
+				star = ++p;
+				starTerm = t;
+			}
+			else if (p < pattern.size() && pattern[p] == '?')
+			{
+				p++;
+				t += character(t);
+			}
+			else if (p < pattern.size() && pattern[p] == term[t])
+			{
+				p++;
+				t++;
+			}
+			else if (star != string_view::npos)
+			{
+				p = star;
+				starTerm += character(starTerm);
+				t = starTerm;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		while (p < pattern.size() && pattern[p] == '*')
+		{
+			p++;
+		}
+		return p == pattern.size();
+	}
+	//calls found(term, id) for terms of the segment matching pattern, only the terms starting with the part before the first wildcard are read
+	template<typename Found>
+	void scanPattern(const segment& s, const string& pattern, Found&& found) const
+	{
+		s.dictionary.scan(string_view(pattern).substr(0, pattern.find_first_of("*?")), [&](string_view term, uint32_t id) {
+			if (matchPattern(pattern, term))
+			{
+				found(term, id);
+			}
+		});
+	}
+	vector<uint32_t> expand(const segment& s, const string& pattern) const
+	{
+		vector<uint32_t> terms;
+		scanPattern(s, pattern, [&](string_view, uint32_t id) { terms.push_back(id); });
+		return terms;
+	}
+	//postings of all terms as one list, occurrences in an article are summed, its offset is the first one and positions are merged
+	postingList unite(const segment& s, const vector<uint32_t>& terms) const
+	{
+		vector<postingCursor> cursors;
+		for (auto term : terms)
+		{
+			cursors.emplace_back(s.postings[term]);
+		}
+		auto later = [&](size_t x, size_t y) { return cursors[x].article() > cursors[y].article(); };
+		priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+		for (size_t i = 0; i < cursors.size(); i++)
+		{
+			heap.push(i);
+		}
+		postingList united;
+		vector<uint32_t> positions, merged;
+		vector<uint8_t> encoded;
+		while (!heap.empty())
+		{
+			uint32_t article = cursors[heap.top()].article();
+			uint32_t frequency = 0, offset = UINT32_MAX;
+			merged.clear();
+			while (!heap.empty() && cursors[heap.top()].article() == article)
+			{
+				postingCursor& cursor = cursors[heap.top()];
+				heap.pop();
+				frequency += cursor.frequency();
+				offset = std::min(offset, cursor.offset());
+				cursor.positions(positions);
+				merged.insert(merged.end(), positions.begin(), positions.end());
+				cursor.next();
+				if (!cursor.atEnd())
+				{
+					heap.push(size_t(&cursor - cursors.data()));
+				}
+			}
+			std::sort(merged.begin(), merged.end());
+			encoded.clear();
+			uint32_t previous = 0;
+			for (auto position : merged)
+			{
+				writeVarint(encoded, position - previous);
+				previous = position;
+			}
+			united.add(article, frequency, offset, s.lengths[article], encoded.data(), uint32_t(encoded.size()));
+		}
+		return united;
+	}
+
+	//"words in quotes" make a phrase, "words in quotes"~N have to be within N words
+	bool readSearchedWords(const segment& s, string line, vector<uint32_t>& searchedTerms, vector<phraseGroup>& groups, expansion& expanded)
+	{
+		bool inQuotes = false;
+		bool known = true;
+		size_t gapStart = 0;
+		//quotes and distances are in the gaps between words
+		auto readGap = [&](size_t end) {
+			for (size_t i = gapStart; i < end; i++)
+			{
+				if (line[i] == '"')
+				{
+					if (inQuotes)
+					{
+						groups.back().last = searchedTerms.size();
+					}
+					else
+					{
+						groups.push_back({ searchedTerms.size(), searchedTerms.size(), 0 });
+					}
+					inQuotes = !inQuotes;
+				}
+				else if (line[i] == '~' && !inQuotes && !groups.empty() && groups.back().last == searchedTerms.size())
+				{
+					while (i + 1 < end && isdigit((unsigned char)line[i + 1]))
+					{
+						i++;
+						groups.back().distance = groups.back().distance * 10 + (line[i] - '0');
+					}
+				}
+			}
+		};
+		string pattern;
+		size_t patternEnd = 0;
+		tokenizer words(utf8);
+		words(line, [&](string_view w, size_t offset) {
+			if (offset < patternEnd)
+			{
+				return;
+			}
+			size_t start = offset, end = offset + w.size();
+			if (!readPattern(line, start, end, pattern))
+			{
+				readGap(offset);
+				gapStart = end;
+				uint32_t term;
+				bool found = s.dictionary.find(w, term);
+				known = known && found;
+				searchedTerms.push_back(found ? term : UINT32_MAX);
+				return;
+			}
+			readGap(start);
+			gapStart = patternEnd = end;
+			vector<uint32_t> matching = expand(s, pattern);
+			known = known && !matching.empty();
+			if (matching.size() == 1)
+			{
+				searchedTerms.push_back(matching[0]);
+			}
+			else if (matching.empty())
+			{
+				searchedTerms.push_back(UINT32_MAX);
+			}
+			else
+			{
+				searchedTerms.push_back(uint32_t(s.postings.size() + expanded.lists.size()));
+				expanded.patterns.push_back(pattern);
+				expanded.lists.push_back(unite(s, matching));
+			}
+		});
+		if (!known)
+		{
+			return 0;
+		}
+		readGap(line.size());
+		if (inQuotes)
+		{
+			groups.back().last = searchedTerms.size();
+		}
+		groups.erase(std::remove_if(groups.begin(), groups.end(), [](const phraseGroup& g) { return g.last - g.first < 2; }), groups.end());
+		return 1;
+	}
+
+	/*checks phrases of the article all cursors are at, span of the first one is returned in words. Phrase takes the positions of its first term
+	and looks up the following positions in the others, for proximity the smallest position is moved until all positions fit into the distance.*/
+	bool matchGroups(vector<postingCursor>& cursors, const vector<phraseGroup>& groups, vector<vector<uint32_t>>& positions,
+		uint32_t& spanStart, uint32_t& spanEnd)
+	{
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			const phraseGroup& group = groups[g];
+			size_t n = group.last - group.first;
+			positions.resize(std::max(positions.size(), n));
+			for (size_t i = 0; i < n; i++)
+			{
+				cursors[group.first + i].positions(positions[i]);
+			}
+			vector<size_t> next(n, 0);
+			bool found = false;
+			uint32_t start = 0, end = 0;
+			if (group.distance == 0)
+			{
+				for (auto first : positions[0])
+				{
+					size_t i = 1;
+					for (; i < n; i++)
+					{
+						const vector<uint32_t>& list = positions[i];
+						while (next[i] < list.size() && list[next[i]] < first + i)
+						{
+							next[i]++;
+						}
+						if (next[i] == list.size() || list[next[i]] != first + i)
+						{
+							break;
+						}
+					}
+					if (i == n)
+					{
+						found = true;
+						start = first;
+						end = first + uint32_t(n) - 1;
+						break;
+					}
+				}
+			}
+			else
+			{
+				while (!found)
+				{
+					size_t smallest = 0;
+					uint32_t largest = 0;
+					for (size_t i = 0; i < n; i++)
+					{
+						if (positions[i][next[i]] < positions[smallest][next[smallest]])
+						{
+							smallest = i;
+						}
+						largest = std::max(largest, positions[i][next[i]]);
+					}
+					start = positions[smallest][next[smallest]];
+					end = largest;
+					found = end - start <= group.distance;
+					if (!found && ++next[smallest] == positions[smallest].size())
+					{
+						break;
+					}
+				}
+			}
+			if (!found)
+			{
+				return false;
+			}
+			if (g == 0)
+			{
+				spanStart = start;
+				spanEnd = end;
+			}
+		}
+		return true;
+	}
+
+	//prints snippet covering words from first to last of the article, at least as long as usual
+	void printSpan(ostream& out, const segment& s, uint32_t article, uint32_t first, uint32_t last)
+	{
+		string_view text = s.articles[article].words_;
+		size_t start = 0, end = 0;
+		uint32_t position = 0;
+		tokenizer words(utf8);
+		words(text, [&](string_view w, size_t offset) {
+			if (position == first)
+			{
+				start = offset;
+			}
+			if (position == last)
+			{
+				end = offset + w.size();
+			}
+			position++;
+		});
+		out << "[" << s.articles[article].id_ << "]" << " " << s.articles[article].title_ << '\n';
+		out << text.substr(start, std::max<size_t>(end - start, 75)) << "..." << '\n';
+	}
+	/*prints articles from first to last (exclusive) containing all searched terms, snippet starts at the first occurrence of the first term or at
+	the first phrase. The rarest term proposes candidates and the others gallop to them. When the two rarest terms are both long, their candidates
+	come from intersectBlocks. Positions are read only for articles which contain all terms.*/
+	void intersection(ostream& out, const segment& s, const vector<uint32_t>& searchedTerms, const vector<phraseGroup>& groups, const expansion& expanded,
+		uint32_t first, uint32_t last) {
+		vector<postingCursor> cursors;
+		for (auto term : searchedTerms)
+		{
+			cursors.emplace_back(list(s, term, expanded));
+		}
+		vector<size_t> order(cursors.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return cursors[x].count() < cursors[y].count(); });
+
+		//moves the rest of cursors to candidate, returns false when one of them has ended
+		auto check = [&](uint32_t candidate, size_t from, uint32_t offset) {
+			for (size_t k = from; k < order.size(); k++)
+			{
+				cursors[order[k]].advance(candidate);
+				if (cursors[order[k]].atEnd())
+				{
+					return false;
+				}
+			}
+			if (std::all_of(order.begin() + from, order.end(), [&](size_t k) { return cursors[k].article() == candidate; }))
+			{
+				printArticle(out, s, candidate, offset);
+			}
+			return true;
+		};
+
+		if (groups.empty() && cursors.size() > 1 && cursors[order[0]].count() >= 4 * blockSize && cursors[order[1]].count() <= 16 * cursors[order[0]].count())
+		{
+			//the first term goes first, so that its offsets are at hand
+			size_t a = order[1] == 0 ? order[1] : order[0];
+			size_t b = a == order[0] ? order[1] : order[0];
+			bool cursorForOffset = a != 0;
+			bool ended = false;
+			intersectBlocks(list(s, searchedTerms[a], expanded), list(s, searchedTerms[b], expanded), first, last, [&](uint32_t article, uint32_t offset) {
+				if (ended)
+				{
+					return;
+				}
+				if (cursorForOffset)
+				{
+					cursors[0].advance(article);
+					offset = cursors[0].offset();
+				}
+				ended = !check(article, 2, offset);
+			});
+			return;
+		}
+
+		vector<vector<uint32_t>> positions;
+		uint32_t spanStart = 0, spanEnd = 0;
+		postingCursor& rarest = cursors[order[0]];
+		rarest.advance(first);
+		while (!rarest.atEnd() && rarest.article() < last)
+		{
+			uint32_t candidate = rarest.article();
+			size_t k = 1;
+			for (; k < order.size(); k++)
+			{
+				postingCursor& cursor = cursors[order[k]];
+				cursor.advance(candidate);
+				if (cursor.atEnd())
+				{
+					return;
+				}
+				if (cursor.article() != candidate)
+				{
+					break;
+				}
+			}
+			if (k == order.size())
+			{
+				if (groups.empty())
+				{
+					printArticle(out, s, candidate, cursors[0].offset());
+				}
+				else if (matchGroups(cursors, groups, positions, spanStart, spanEnd))
+				{
+					printSpan(out, s, candidate, spanStart, spanEnd);
+				}
+				rarest.next();
+			}
+			else
+			{
+				rarest.advance(cursors[order[k]].article());
+			}
+		}
+	}
+	/*Lazy iterator over articles matching a part of a boolean query, it is at the first match after it is made and moves only when asked,
+	so a consumer which stops early does not pay for the rest. advance(target) moves to the first match not before target.*/
+	class queryIterator
+	{
+	public:
+		virtual ~queryIterator() {}
+		virtual bool atEnd() const = 0;
+		virtual uint32_t article() const = 0;
+		virtual void next() = 0;
+		virtual void advance(uint32_t target) = 0;
+		//offset of the first occurrence of a searched word in the current article, false when only negated words decided it
+		virtual bool offset(uint32_t& result) const = 0;
+		//at most how many articles it gives, the planner orders operands by it
+		uint64_t cost = 0;
+	};
+
+	class termIterator : public queryIterator
+	{
+	public:
+		termIterator(const postingList& list) :cursor(list)
+		{
+			cost = list.count;
+		}
+		bool atEnd() const override
+		{
+			return cursor.atEnd();
+		}
+		uint32_t article() const override
+		{
+			return cursor.article();
+		}
+		void next() override
+		{
+			cursor.next();
+		}
+		void advance(uint32_t target) override
+		{
+			cursor.advance(target);
+		}
+		bool offset(uint32_t& result) const override
+		{
+			result = cursor.offset();
+			return true;
+		}
+	private:
+		postingCursor cursor;
+	};
+
+	//all articles, for negations which have nothing to be subtracted from
+	class allIterator : public queryIterator
+	{
+	public:
+		allIterator(uint32_t count) :count(count)
+		{
+			cost = count;
+		}
+		bool atEnd() const override
+		{
+			return current >= count;
+		}
+		uint32_t article() const override
+		{
+			return current;
+		}
+		void next() override
+		{
+			current++;
+		}
+		void advance(uint32_t target) override
+		{
+			current = std::max(current, target);
+		}
+		bool offset(uint32_t&) const override
+		{
+			return false;
+		}
+	private:
+		uint32_t count;
+		uint32_t current = 0;
+	};
+
+	//the cheapest operand proposes candidates, the others skip to them with their skip pointers
+	class andIterator : public queryIterator
+	{
+	public:
+		andIterator(vector<unique_ptr<queryIterator>>&& operands) :operands(std::move(operands)), order(this->operands.size())
+		{
+			cost = UINT64_MAX;
+			for (size_t i = 0; i < order.size(); i++)
+			{
+				order[i] = i;
+				cost = std::min(cost, this->operands[i]->cost);
+			}
+			std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return this->operands[x]->cost < this->operands[y]->cost; });
+			settle();
+		}
+		bool atEnd() const override
+		{
+			return finished;
+		}
+		uint32_t article() const override
+		{
+			return operands[order[0]]->article();
+		}
+		void next() override
+		{
+			operands[order[0]]->next();
+			settle();
+		}
+		void advance(uint32_t target) override
+		{
+			operands[order[0]]->advance(target);
+			settle();
+		}
+		//operands are in the order of the query, so the snippet is the same whichever operand leads
+		bool offset(uint32_t& result) const override
+		{
+			for (auto&& operand : operands)
+			{
+				if (operand->offset(result))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+	private:
+		void settle()
+		{
+			queryIterator& lead = *operands[order[0]];
+			while (!lead.atEnd())
+			{
+				uint32_t candidate = lead.article();
+				size_t k = 1;
+				for (; k < order.size(); k++)
+				{
+					queryIterator& operand = *operands[order[k]];
+					operand.advance(candidate);
+					if (operand.atEnd())
+					{
+						finished = true;
+						return;
+					}
+					if (operand.article() != candidate)
+					{
+						break;
+					}
+				}
+				if (k == order.size())
+				{
+					return;
+				}
+				lead.advance(operands[order[k]]->article());
+			}
+			finished = true;
+		}
+		vector<unique_ptr<queryIterator>> operands;
+		vector<size_t> order;
+		bool finished = false;
+	};
+
+	//operands in a heap by their current article
+	class orIterator : public queryIterator
+	{
+	public:
+		orIterator(vector<unique_ptr<queryIterator>>&& operands) :operands(std::move(operands))
+		{
+			for (size_t i = 0; i < this->operands.size(); i++)
+			{
+				cost += this->operands[i]->cost;
+				if (!this->operands[i]->atEnd())
+				{
+					heap.push_back(i);
+				}
+			}
+			std::make_heap(heap.begin(), heap.end(), later());
+		}
+		bool atEnd() const override
+		{
+			return heap.empty();
+		}
+		uint32_t article() const override
+		{
+			return operands[heap.front()]->article();
+		}
+		void next() override
+		{
+			advance(article() + 1);
+		}
+		void advance(uint32_t target) override
+		{
+			while (!heap.empty() && operands[heap.front()]->article() < target)
+			{
+				std::pop_heap(heap.begin(), heap.end(), later());
+				queryIterator& operand = *operands[heap.back()];
+				operand.advance(target);
+				if (operand.atEnd())
+				{
+					heap.pop_back();
+				}
+				else
+				{
+					std::push_heap(heap.begin(), heap.end(), later());
+				}
+			}
+		}
+		//the earliest of the operands in the article, like a union of lists
+		bool offset(uint32_t& result) const override
+		{
+			uint32_t first = UINT32_MAX, operandOffset;
+			for (auto&& operand : operands)
+			{
+				if (!operand->atEnd() && operand->article() == article() && operand->offset(operandOffset))
+				{
+					first = std::min(first, operandOffset);
+				}
+			}
+			if (first == UINT32_MAX)
+			{
+				return false;
+			}
+			result = first;
+			return true;
+		}
+	private:
+		class laterArticle
+		{
+		public:
+			const vector<unique_ptr<queryIterator>>* operands;
+			bool operator()(size_t x, size_t y) const
+			{
+				return (*operands)[x]->article() > (*operands)[y]->article();
+			}
+		};
+		laterArticle later() const
+		{
+			return laterArticle{ &operands };
+		}
+		vector<unique_ptr<queryIterator>> operands;
+		vector<size_t> heap;
+	};
+
+	//articles of included which are not in excluded, excluded only follows included
+	class differenceIterator : public queryIterator
+	{
+	public:
+		differenceIterator(unique_ptr<queryIterator>&& included, unique_ptr<queryIterator>&& excluded) :included(std::move(included)),
+			excluded(std::move(excluded))
+		{
+			cost = this->included->cost;
+			settle();
+		}
+		bool atEnd() const override
+		{
+			return included->atEnd();
+		}
+		uint32_t article() const override
+		{
+			return included->article();
+		}
+		void next() override
+		{
+			included->next();
+			settle();
+		}
+		void advance(uint32_t target) override
+		{
+			included->advance(target);
+			settle();
+		}
+		bool offset(uint32_t& result) const override
+		{
+			return included->offset(result);
+		}
+	private:
+		void settle()
+		{
+			while (!included->atEnd())
+			{
+				excluded->advance(included->article());
+				if (excluded->atEnd() || excluded->article() != included->article())
+				{
+					return;
+				}
+				included->next();
+			}
+		}
+		unique_ptr<queryIterator> included;
+		unique_ptr<queryIterator> excluded;
+	};
+
+	//articles where the lists are next to each other or within distance words, checked by matchGroups
+	class phraseIterator : public queryIterator
+	{
+	public:
+		phraseIterator(Solver& solver, const vector<const postingList*>& lists, uint32_t distance) :solver(solver),
+			groups{ phraseGroup{ 0, lists.size(), distance } }
+		{
+			cost = UINT64_MAX;
+			for (auto list : lists)
+			{
+				cursors.emplace_back(*list);
+				cost = std::min<uint64_t>(cost, list->count);
+			}
+			settle();
+		}
+		bool atEnd() const override
+		{
+			return cursors[0].atEnd();
+		}
+		uint32_t article() const override
+		{
+			return cursors[0].article();
+		}
+		void next() override
+		{
+			cursors[0].next();
+			settle();
+		}
+		void advance(uint32_t target) override
+		{
+			cursors[0].advance(target);
+			settle();
+		}
+		bool offset(uint32_t& result) const override
+		{
+			result = cursors[0].offset();
+			return true;
+		}
+	private:
+		void settle()
+		{
+			while (!cursors[0].atEnd())
+			{
+				uint32_t candidate = cursors[0].article();
+				size_t k = 1;
+				for (; k < cursors.size(); k++)
+				{
+					cursors[k].advance(candidate);
+					if (cursors[k].atEnd())
+					{
+						cursors[0].advance(UINT32_MAX);
+						return;
+					}
+					if (cursors[k].article() != candidate)
+					{
+						break;
+					}
+				}
+				if (k < cursors.size())
+				{
+					cursors[0].advance(cursors[k].article());
+					continue;
+				}
+				uint32_t spanStart, spanEnd;
+				if (solver.matchGroups(cursors, groups, positions, spanStart, spanEnd))
+				{
+					return;
+				}
+				cursors[0].next();
+			}
+		}
+		Solver& solver;
+		vector<phraseGroup> groups;
+		vector<postingCursor> cursors;
+		vector<vector<uint32_t>> positions;
+	};
+
+	/*Boolean query - AND (or nothing) binds words tighter than OR, NOT negates the following operand, parentheses group and "phrases" are operands.
+	Operators have to be written in capitals, so that the words and, or and not can still be searched.*/
+	class queryNode
+	{
+	public:
+		enum nodeType { termNode, phraseNode, andNode, orNode, notNode };
+		nodeType type;
+		//terms of a word (all terms of a pattern, none for an unknown word), or lists of the words of a phrase
+		vector<uint32_t> terms;
+		uint32_t distance = 0;
+		vector<unique_ptr<queryNode>> children;
+	};
+	class queryToken
+	{
+	public:
+		enum tokenType { wordToken, phraseToken, openToken, closeToken, andToken, orToken, notToken };
+		tokenType type;
+		vector<uint32_t> terms{};
+		uint32_t distance = 0;
+	};
+
+	//queries with parentheses or an operator are boolean
+	bool isBoolean(string_view line) const
+	{
+		bool found = line.find_first_of("()") != string_view::npos;
+		tokenizer words(utf8);
+		words(line, [&](string_view w, size_t offset) {
+			string_view original = line.substr(offset, w.size());
+			found = found || original == "AND" || original == "OR" || original == "NOT";
+		});
+		return found;
+	}
+	//words, patterns and phrases with the terms of the segment they stand for, operators and parentheses
+	vector<queryToken> readQueryTokens(const segment& s, string_view line, expansion& expanded)
+	{
+		vector<queryToken> tokens;
+		bool inQuotes = false;
+		vector<vector<uint32_t>> phrase;
+		//phrase of one word is the word, phrase with a pattern gets its union as one list
+		auto closePhrase = [&]() {
+			inQuotes = false;
+			if (phrase.size() == 1)
+			{
+				tokens.push_back({ queryToken::wordToken, std::move(phrase[0]) });
+			}
+			else if (!phrase.empty())
+			{
+				tokens.push_back({ queryToken::phraseToken });
+				bool known = std::all_of(phrase.begin(), phrase.end(), [](const vector<uint32_t>& terms) { return !terms.empty(); });
+				for (auto&& terms : phrase)
+				{
+					if (!known)
+					{
+						break;
+					}
+					if (terms.size() == 1)
+					{
+						tokens.back().terms.push_back(terms[0]);
+						continue;
+					}
+					tokens.back().terms.push_back(uint32_t(s.postings.size() + expanded.lists.size()));
+					expanded.patterns.emplace_back();
+					expanded.lists.push_back(unite(s, terms));
+				}
+			}
+			phrase.clear();
+		};
+		size_t gapStart = 0;
+		auto readGap = [&](size_t end) {
+			for (size_t i = gapStart; i < end; i++)
+			{
+				if (line[i] == '"')
+				{
+					if (inQuotes)
+					{
+						closePhrase();
+					}
+					else
+					{
+						inQuotes = true;
+					}
+				}
+				else if (!inQuotes && (line[i] == '(' || line[i] == ')'))
+				{
+					tokens.push_back({ line[i] == '(' ? queryToken::openToken : queryToken::closeToken });
+				}
+				else if (!inQuotes && line[i] == '~' && !tokens.empty() && tokens.back().type == queryToken::phraseToken)
+				{
+					while (i + 1 < end && isdigit((unsigned char)line[i + 1]))
+					{
+						i++;
+						tokens.back().distance = tokens.back().distance * 10 + (line[i] - '0');
+					}
+				}
+			}
+		};
+		string pattern;
+		size_t patternEnd = 0;
+		tokenizer words(utf8);
+		words(line, [&](string_view w, size_t offset) {
+			if (offset < patternEnd)
+			{
+				return;
+			}
+			size_t start = offset, end = offset + w.size();
+			bool isPattern = readPattern(line, start, end, pattern);
+			readGap(start);
+			gapStart = patternEnd = end;
+			string_view original = line.substr(start, end - start);
+			if (!inQuotes && (original == "AND" || original == "OR" || original == "NOT"))
+			{
+				tokens.push_back({ original == "AND" ? queryToken::andToken : original == "OR" ? queryToken::orToken : queryToken::notToken });
+				return;
+			}
+			vector<uint32_t> terms;
+			uint32_t term;
+			if (isPattern)
+			{
+				terms = expand(s, pattern);
+			}
+			else
+			{
+				if (s.dictionary.find(w, term))
+				{
+					terms.push_back(term);
+				}
+			}
+			if (inQuotes)
+			{
+				phrase.push_back(std::move(terms));
+			}
+			else
+			{
+				tokens.push_back({ queryToken::wordToken, std::move(terms) });
+			}
+		});
+		readGap(line.size());
+		if (inQuotes)
+		{
+			closePhrase();
+		}
+		return tokens;
+	}
+
+	unique_ptr<queryNode> combine(queryNode::nodeType type, vector<unique_ptr<queryNode>>& operands)
+	{
+		if (operands.size() < 2)
+		{
+			return operands.empty() ? nullptr : std::move(operands[0]);
+		}
+		auto node = make_unique<queryNode>();
+		node->type = type;
+		node->children = std::move(operands);
+		return node;
+	}
+	//operators without operands and unmatched parentheses are left out
+	unique_ptr<queryNode> parseOr(const vector<queryToken>& tokens, size_t& next)
+	{
+		vector<unique_ptr<queryNode>> operands;
+		while (next < tokens.size() && tokens[next].type != queryToken::closeToken)
+		{
+			if (tokens[next].type == queryToken::orToken)
+			{
+				next++;
+				continue;
+			}
+			if (auto operand = parseAnd(tokens, next))
+			{
+				operands.push_back(std::move(operand));
+			}
+		}
+		return combine(queryNode::orNode, operands);
+	}
+	unique_ptr<queryNode> parseAnd(const vector<queryToken>& tokens, size_t& next)
+	{
+		vector<unique_ptr<queryNode>> operands;
+		while (next < tokens.size() && tokens[next].type != queryToken::closeToken && tokens[next].type != queryToken::orToken)
+		{
+			if (tokens[next].type == queryToken::andToken)
+			{
+				next++;
+				continue;
+			}
+			if (auto operand = parseOperand(tokens, next))
+			{
+				operands.push_back(std::move(operand));
+			}
+		}
+		return combine(queryNode::andNode, operands);
+	}
+	unique_ptr<queryNode> parseOperand(const vector<queryToken>& tokens, size_t& next)
+	{
+		const queryToken& token = tokens[next++];
+		if (token.type == queryToken::openToken)
+		{
+			unique_ptr<queryNode> inner = parseOr(tokens, next);
+			if (next < tokens.size())
+			{
+				next++;
+			}
+			return inner;
+		}
+		if (token.type == queryToken::notToken)
+		{
+			if (next == tokens.size() || tokens[next].type == queryToken::closeToken || tokens[next].type == queryToken::orToken
+				|| tokens[next].type == queryToken::andToken)
+			{
+				return nullptr;
+			}
+			unique_ptr<queryNode> negated = parseOperand(tokens, next);
+			if (!negated)
+			{
+				return nullptr;
+			}
+			auto node = make_unique<queryNode>();
+			node->type = queryNode::notNode;
+			node->children.push_back(std::move(negated));
+			return node;
+		}
+		auto node = make_unique<queryNode>();
+		node->type = token.type == queryToken::phraseToken ? queryNode::phraseNode : queryNode::termNode;
+		node->terms = token.terms;
+		node->distance = token.distance;
+		return node;
+	}
+	unique_ptr<queryNode> parseQuery(const vector<queryToken>& tokens)
+	{
+		vector<unique_ptr<queryNode>> parts;
+		for (size_t next = 0; next < tokens.size(); next++)
+		{
+			if (auto part = parseOr(tokens, next))
+			{
+				parts.push_back(std::move(part));
+			}
+		}
+		return combine(queryNode::andNode, parts);
+	}
+
+	/*Plan of the query as iterators. Operands of AND are ordered by length of their lists, its negated operands are subtracted together from
+	the result of the others, so NOT never has to enumerate all articles unless nothing else is searched.*/
+	unique_ptr<queryIterator> plan(const segment& s, const queryNode& node, const expansion& expanded)
+	{
+		vector<unique_ptr<queryIterator>> operands;
+		if (node.type == queryNode::termNode && node.terms.size() == 1)
+		{
+			return make_unique<termIterator>(s.postings[node.terms[0]]);
+		}
+		if (node.type == queryNode::termNode)
+		{
+			for (auto term : node.terms)
+			{
+				operands.push_back(make_unique<termIterator>(s.postings[term]));
+			}
+			return make_unique<orIterator>(std::move(operands));
+		}
+		if (node.type == queryNode::phraseNode)
+		{
+			if (node.terms.empty())
 			{
-				c += 'a' - 'A';
+				return make_unique<orIterator>(std::move(operands));
 			}
-
-			cWord += c;
+			vector<const postingList*> lists;
+			for (auto term : node.terms)
+			{
+				lists.push_back(&list(s, term, expanded));
+			}
+			return make_unique<phraseIterator>(*this, lists, node.distance);
 		}
-		else if (cWord != "")
+		if (node.type == queryNode::notNode)
 		{
-			addWord(cWord, charCount - cWord.size(),addedWords,newArticle);
-			cWord = "";
+			return make_unique<differenceIterator>(make_unique<allIterator>(uint32_t(s.articles.size())), plan(s, *node.children[0], expanded));
 		}
-	}
-	void addWord(string word, int charCount,unordered_set<string>& addedWords,databaseIterator_t newArticle)
-	{
-		if (addedWords.find(word) == addedWords.end())
+		if (node.type == queryNode::orNode)
+		{
+			for (auto&& child : node.children)
+			{
+				operands.push_back(plan(s, *child, expanded));
+			}
+			return make_unique<orIterator>(std::move(operands));
+		}
+		vector<unique_ptr<queryIterator>> excluded;
+		for (auto&& child : node.children)
 		{
-			addedWords.emplace(word);
-			auto existing = wordToArticleIndex.find(word);
-			if (existing != wordToArticleIndex.end() && existing->second != store.end())
+			if (child->type == queryNode::notNode)
 			{
-				existing->second->push_back({ charCount, newArticle });
-				//cout << cIterator->id_;
+				excluded.push_back(plan(s, *child->children[0], expanded));
 			}
 			else
 			{
-				dataItem_t newPair;
-				newPair.push_back({ charCount,newArticle });
-				//cout << cIterator->id_;
-				store.push_back(newPair);
-
-				auto newItem = store.end();
-				newItem--;
-
-				wordToArticleIndex.emplace(word, newItem);
+				operands.push_back(plan(s, *child, expanded));
 			}
 		}
+		unique_ptr<queryIterator> included;
+		if (operands.empty())
+		{
+			included = make_unique<allIterator>(uint32_t(s.articles.size()));
+		}
+		else if (operands.size() == 1)
+		{
+			included = std::move(operands[0]);
+		}
+		else
+		{
+			included = make_unique<andIterator>(std::move(operands));
+		}
+		if (excluded.empty())
+		{
+			return included;
+		}
+		unique_ptr<queryIterator> excludedUnion = excluded.size() == 1 ? std::move(excluded[0]) : make_unique<orIterator>(std::move(excluded));
+		return make_unique<differenceIterator>(std::move(included), std::move(excludedUnion));
 	}
-	void readWords(string& thirdLine,databaseIterator_t newArticle)
+	//prints articles of the segment from first to last (exclusive) given by the plan, returns how many there were
+	size_t printBoolean(ostream& out, const segment& s, queryIterator& results, uint32_t first, uint32_t last)
 	{
-		unordered_set<string> addedWords;
-		char c;
-		string Cword;
-		int charCount = 0;
-		for (auto i = thirdLine.begin(); i != thirdLine.end(); i++)
+		size_t printed = 0;
+		for (results.advance(first); !results.atEnd() && results.article() < last; results.next(), printed++)
 		{
-			c = *i;
-			processOneLetter(c, charCount,Cword,addedWords,newArticle);
-			charCount += 1;
+			uint32_t offset;
+			if (!results.offset(offset))
+			{
+				offset = 0;
+			}
+			printArticle(out, s, results.article(), offset);
 		}
-		addWord(Cword, charCount - Cword.size(),addedWords,newArticle);
+		return printed;
 	}
+	//BM25 score of one term in an article with given number of occurrences of the term and number of words
+	class bm25
+	{
+	public:
+		bm25(double idf, double averageLength) :idf(idf), averageLength(averageLength) {}
+		double operator()(uint32_t frequency, uint32_t length) const
+		{
+			return idf * frequency * (k1 + 1) / (frequency + k1 * (1 - b + b * length / averageLength));
+		}
+		double idf;
+		double averageLength;
+		static constexpr double k1 = 1.2;
+		static constexpr double b = 0.75;
+	};
+
+	class scoredArticle
+	{
+	public:
+		double score;
+		uint32_t article;
+		uint32_t offset;
+	};
 
-	void readArticles(string& articles)
+	/*k articles with the highest BM25 score for any of the searched terms, best first. Block-max MaxScore - terms are sorted by their greatest
+	score, those which together cannot get an article into the top k are not essential and are only looked up for candidates from the others.
+	Before that, greatest score in the block of the candidate bounds what the term can add, so most of their postings are never decoded.
+	Only articles from first to last (exclusive) are scored, the bounds come from their blocks only.*/
+	vector<scoredArticle> topK(const segment& s, const vector<uint32_t>& searchedTerms, const vector<bm25>& scorers, size_t k, uint32_t first, uint32_t last)
 	{
-		ifstream myfile(articles);
-		if (myfile.is_open())
+		class scoredTerm
 		{
-			string currID;
-			string currTitle;
-			string currText;
-			string line;
-			getline(myfile, line);
-			while (line != "")
+		public:
+			postingCursor cursor;
+			bm25 scorer;
+			double weight;
+			double maxScore;
+			size_t position;
+			uint32_t term;
+		};
+		vector<scoredTerm> terms;
+		for (size_t i = 0; i < searchedTerms.size(); i++)
+		{
+			if (searchedTerms[i] == UINT32_MAX)
+			{
+				continue;
+			}
+			auto same = std::find_if(terms.begin(), terms.end(), [&](const scoredTerm& t) { return t.term == searchedTerms[i]; });
+			if (same != terms.end())
+			{
+				same->weight++;
+				continue;
+			}
+			const postingList& list = s.postings[searchedTerms[i]];
+			const bm25& scorer = scorers[i];
+			double maxScore = 0;
+			for (size_t block = 0; block < list.skipCount() && list.skipData()[block].base < last; block++)
 			{
-				currID = line;
-				getline(myfile, line);
-				currTitle = line;
-				getline(myfile, line);
-				currText = line;
-				mainData.push_back(Article{ currID,currTitle,currText });
-				auto cIterator = mainData.end();
-				cIterator--;
-				readWords(line,cIterator);
-				getline(myfile, line);
+				if (list.skipData()[block].last >= first)
+				{
+					maxScore = std::max(maxScore, scorer(list.skipData()[block].maxFrequency, list.skipData()[block].minLength));
+				}
 			}
-			myfile.close();
+			terms.push_back({ postingCursor(list), scorer, 1, maxScore, i, searchedTerms[i] });
+			terms.back().cursor.advance(first);
+		}
+		for (auto&& t : terms)
+		{
+			t.maxScore *= t.weight;
+		}
+		std::sort(terms.begin(), terms.end(), [](const scoredTerm& x, const scoredTerm& y) { return x.maxScore < y.maxScore; });
+		vector<double> bound(terms.size());
+		for (size_t i = 0; i < terms.size(); i++)
+		{
+			bound[i] = (i == 0 ? 0 : bound[i - 1]) + terms[i].maxScore;
 		}
-	}
 
-	void find(string word)
-	{
-		auto iteratorIntoWordToArticleIndex = wordToArticleIndex.find(word);
-		if (iteratorIntoWordToArticleIndex != wordToArticleIndex.end() &&
-			iteratorIntoWordToArticleIndex->second != store.end())
+		//worst of the best k at the top
+		auto worse = [](const scoredArticle& x, const scoredArticle& y) { return x.score > y.score || (x.score == y.score && x.article < y.article); };
+		vector<scoredArticle> best;
+		double threshold = 0;
+		size_t firstEssential = 0;
+		while (firstEssential < terms.size())
 		{
-			auto path = iteratorIntoWordToArticleIndex->second;
-			for (auto&& item : *path)
+			uint32_t candidate = UINT32_MAX;
+			for (size_t i = firstEssential; i < terms.size(); i++)
+			{
+				if (!terms[i].cursor.atEnd())
+				{
+					candidate = std::min(candidate, terms[i].cursor.article());
+				}
+			}
+			if (candidate == UINT32_MAX || candidate >= last)
+			{
+				break;
+			}
+			double score = 0;
+			size_t snippetFrom = SIZE_MAX;
+			uint32_t offset = 0;
+			auto found = [&](scoredTerm& t) {
+				score += t.weight * t.scorer(t.cursor.frequency(), s.lengths[candidate]);
+				if (t.position < snippetFrom)
+				{
+					snippetFrom = t.position;
+					offset = t.cursor.offset();
+				}
+			};
+			for (size_t i = firstEssential; i < terms.size(); i++)
+			{
+				if (!terms[i].cursor.atEnd() && terms[i].cursor.article() == candidate)
+				{
+					found(terms[i]);
+					terms[i].cursor.next();
+				}
+			}
+			bool pruned = false;
+			for (size_t i = firstEssential; i-- > 0;)
+			{
+				scoredTerm& t = terms[i];
+				if (score + bound[i] <= threshold)
+				{
+					pruned = true;
+					break;
+				}
+				const skipEntry* skip = t.cursor.atEnd() ? nullptr : t.cursor.findBlock(candidate);
+				double blockScore = skip == nullptr ? 0 : t.weight * t.scorer(skip->maxFrequency, skip->minLength);
+				if (score + bound[i] - t.maxScore + blockScore <= threshold)
+				{
+					pruned = true;
+					break;
+				}
+				if (skip != nullptr)
+				{
+					t.cursor.advance(candidate);
+					if (!t.cursor.atEnd() && t.cursor.article() == candidate)
+					{
+						found(t);
+					}
+				}
+			}
+			if (pruned || (best.size() == k && score <= threshold))
+			{
+				continue;
+			}
+			best.push_back({ score, candidate, offset });
+			std::push_heap(best.begin(), best.end(), worse);
+			if (best.size() > k)
 			{
-				cout << "[" << item.second->id_ << "]" << " " << item.second->title_ << endl;
-				string s = item.second->words_.substr(item.first, 75);
-				cout << s << "..." << endl;
+				std::pop_heap(best.begin(), best.end(), worse);
+				best.pop_back();
+			}
+			if (best.size() == k)
+			{
+				threshold = best.front().score;
+				while (firstEssential < terms.size() && bound[firstEssential] <= threshold)
+				{
+					firstEssential++;
+				}
 			}
 		}
+		std::sort_heap(best.begin(), best.end(), worse);
+		return best;
 	}
-	bool readSearchedWords(string line, sAndIt_t& searchedWordsAndIterators)
+
+	//lowercased words of the query which are in any segment, a pattern adds all terms it matches
+	vector<string> readQueryWords(const snapshot& index, string_view line)
 	{
-		char c;
-		string searchedWord;
-		for (auto i = line.begin(); i != line.end(); i++)
-		{
-			c = *i;
-			if (isalpha(c)) {
-				if (c >= 'A' && c <= 'Z')
+		vector<string> found;
+		string pattern;
+		size_t patternEnd = 0;
+		tokenizer words(utf8);
+		words(line, [&](string_view w, size_t offset) {
+			size_t start = offset, end = offset + w.size();
+			uint32_t term;
+			if (offset < patternEnd)
+			{
+				return;
+			}
+			if (readPattern(line, start, end, pattern))
+			{
+				patternEnd = end;
+				set<string> matching;
+				for (auto&& s : index.segments)
 				{
-					c += 'a' - 'A';
+					scanPattern(*s, pattern, [&](string_view t, uint32_t) { matching.emplace(t); });
 				}
-
-				searchedWord += c;
+				found.insert(found.end(), matching.begin(), matching.end());
+			}
+			else if (std::any_of(index.segments.begin(), index.segments.end(), [&](auto&& s) { return s->dictionary.find(w, term); }))
+			{
+				found.emplace_back(w);
 			}
-			if ((searchedWord != "")&&(!isalpha(c)||i ==--line.end()))
+		});
+		return found;
+	}
+	//every shard finds its best articles by BM25 with statistics of all segments, the best of them are printed
+	void printRanked(ostream& out, const snapshot& index, const vector<string>& words)
+	{
+		double averageLength = index.articleCount == 0 ? 1 : std::max(double(index.totalLength) / index.articleCount, 1.0);
+		vector<bm25> scorers;
+		for (auto&& word : words)
+		{
+			double df = 0;
+			for (auto&& s : index.segments)
 			{
-				if (wordToArticleIndex.find(searchedWord) != wordToArticleIndex.end())
+				uint32_t term;
+				if (s->dictionary.find(word, term))
 				{
-					addSearchedWord(searchedWord,searchedWordsAndIterators);
-					searchedWord = "";
+					df += s->postings[term].count;
 				}
-				else
+			}
+			scorers.push_back(bm25(log(1 + (index.articleCount - df + 0.5) / (df + 0.5)), averageLength));
+		}
+		vector<vector<uint32_t>> terms(index.segments.size());
+		for (size_t i = 0; i < index.segments.size(); i++)
+		{
+			for (auto&& word : words)
+			{
+				uint32_t term;
+				terms[i].push_back(index.segments[i]->dictionary.find(word, term) ? term : UINT32_MAX);
+			}
+		}
+		vector<vector<shardPart>> shards = splitShards(index);
+		vector<vector<pair<size_t, scoredArticle>>> shardBest(shards.size());
+		forShards(shards.size(), [&](size_t k) {
+			for (auto&& part : shards[k])
+			{
+				for (auto&& result : topK(*index.segments[part.segment], terms[part.segment], scorers, rankedResults, part.first, part.last))
 				{
-					return 0;
+					shardBest[k].push_back({ part.segment, result });
 				}
 			}
+		});
+		vector<pair<size_t, scoredArticle>> best;
+		for (auto&& results : shardBest)
+		{
+			best.insert(best.end(), results.begin(), results.end());
 		}
-		return 1;
-	}
-	void addSearchedWord(string word,sAndIt_t& searchedWordsAndIterators) {
-		auto existing = wordToArticleIndex.find(word);
-		if (existing != wordToArticleIndex.end()) {
-			searchedWordsAndIterators.push_back({ word,wordToArticleIndex.find(word)->second->begin() });
-			sAndIt_t::iterator x = searchedWordsAndIterators.end();
-			x--;
+		//of equal scores the earlier article goes first, as in one segment
+		std::sort(best.begin(), best.end(), [](const pair<size_t, scoredArticle>& x, const pair<size_t, scoredArticle>& y) {
+			if (x.second.score != y.second.score)
+			{
+				return x.second.score > y.second.score;
+			}
+			return x.first != y.first ? x.first < y.first : x.second.article < y.second.article;
+		});
+		best.resize(std::min(best.size(), rankedResults));
+		if (best.empty())
+		{
+			out << "No results" << '\n';
+		}
+		for (auto&& result : best)
+		{
+			printArticle(out, *index.segments[result.first], result.second.article, result.second.offset);
 		}
 	}
-	void intersection(sAndIt_t& searchedWordsAndIterators) {
-		bool isEnd = false;
-		while (!isEnd) {
-			string min;
-			bool areEqual = true;
-			bool isFirst = true;
-			for (auto&& item : searchedWordsAndIterators)
+	//query without what does not change its answer - case of words, spaces and other characters
+	string queryKey(string_view line) const
+	{
+		string key;
+		size_t gapStart = 0;
+		auto readGap = [&](size_t end) {
+			for (size_t i = gapStart; i < end; i++)
+			{
+				if (strchr("\"()~*?0123456789", line[i]) != nullptr && line[i] != 0)
+				{
+					key += line[i];
+				}
+			}
+			key += ' ';
+		};
+		tokenizer words(utf8);
+		words(line, [&](string_view w, size_t offset) {
+			readGap(offset);
+			gapStart = offset + w.size();
+			string_view original = line.substr(offset, w.size());
+			key += original == "AND" || original == "OR" || original == "NOT" ? original : w;
+		});
+		readGap(line.size());
+		return key;
+	}
+	/*answers one query, the index is only read, so more queries can be answered at once and articles can be added meanwhile. Answers are cached
+	by the normalized query and the generation of the index, so they are not mixed up with answers from before articles were added.*/
+	void answer(const string& line, ostream& out)
+	{
+		shared_ptr<const snapshot> index = current();
+		string key = to_string(index->generation) + ":" + queryKey(line);
+		auto answerCached = [&](auto&& evaluate) {
+			string cached;
+			if (!cache.enabled())
+			{
+				evaluate(out);
+			}
+			else if (cache.find(key, cached))
 			{
-				if (item.second != (wordToArticleIndex.find(item.first))->second->end()) {
-					if (isFirst)
+				out << cached;
+			}
+			else
+			{
+				ostringstream buffer;
+				evaluate(buffer);
+				cached = buffer.str();
+				cache.insert(key, cached);
+				out << cached;
+			}
+		};
+		if (rankedResults > 0)
+		{
+			key = "top " + to_string(rankedResults) + ":" + key;
+			answerCached([&](ostream& o) { printRanked(o, *index, readQueryWords(*index, line)); });
+			out << '\n';
+			return;
+		}
+		vector<vector<shardPart>> shards = splitShards(*index);
+		if (isBoolean(line))
+		{
+			answerCached([&](ostream& o) {
+				//every shard makes its own plan, iterators are not shared
+				vector<expansion> expanded(index->segments.size());
+				vector<unique_ptr<queryNode>> queries;
+				for (size_t i = 0; i < index->segments.size(); i++)
+				{
+					queries.push_back(parseQuery(readQueryTokens(*index->segments[i], line, expanded[i])));
+				}
+				vector<size_t> printed(shards.size());
+				printShards(o, shards.size(), [&](ostream& shardOut, size_t k) {
+					for (auto&& part : shards[k])
 					{
-						isFirst = false;
-						min = item.second->second->id_;
+						const segment& s = *index->segments[part.segment];
+						if (queries[part.segment])
+						{
+							printed[k] += printBoolean(shardOut, s, *plan(s, *queries[part.segment], expanded[part.segment]), part.first, part.last);
+						}
 					}
-					else if (item.second->second->id_ < min)
+				});
+				if (std::all_of(printed.begin(), printed.end(), [](size_t p) { return p == 0; }))
+				{
+					o << "No results" << '\n';
+				}
+			});
+			out << '\n';
+			return;
+		}
+		//segment without some word has no results, the query has none at all when a word is in no segment. Unknown words are UINT32_MAX.
+		class parsedQuery
+		{
+		public:
+			vector<uint32_t> searchedTerms;
+			vector<phraseGroup> groups;
+			expansion expanded;
+			bool areAllWordsInAnyArticle;
+		};
+		vector<parsedQuery> parsed(index->segments.size());
+		for (size_t i = 0; i < parsed.size(); i++)
+		{
+			parsedQuery& q = parsed[i];
+			q.areAllWordsInAnyArticle = readSearchedWords(*index->segments[i], line, q.searchedTerms, q.groups, q.expanded);
+		}
+		size_t wordCount = parsed.empty() ? 0 : parsed[0].searchedTerms.size();
+		size_t firstUnknown = 0;
+		while (firstUnknown < wordCount && std::any_of(parsed.begin(), parsed.end(), [&](const parsedQuery& q) { return q.searchedTerms[firstUnknown] != UINT32_MAX; }))
+		{
+			firstUnknown++;
+		}
+
+		if (wordCount > 0 && firstUnknown == wordCount)
+		{
+			answerCached([&](ostream& o) {
+				printShards(o, shards.size(), [&](ostream& shardOut, size_t k) {
+					for (auto&& part : shards[k])
 					{
-						min = item.second->second->id_;
-						areEqual = false;
+						const parsedQuery& q = parsed[part.segment];
+						if (q.areAllWordsInAnyArticle)
+						{
+							intersection(shardOut, *index->segments[part.segment], q.searchedTerms, q.groups, q.expanded, part.first, part.last);
+						}
 					}
-					else if (item.second->second->id_ > min)
+				});
+			});
+		}
+		else if (firstUnknown > 0) {
+			out << "No results" << '\n';
+		}
+		out << '\n';
+	}
+	void readCommandsFile(istream& source)
+	{
+		string line;
+		while (getline(source, line))
+		{
+			answer(line, cout);
+		}
+	}
+
+};
+/*Answers queries of any number of connections with one pool of threads. Every query is answered into its own buffer, a connection gets
+the buffers in the order of its queries and its output is flushed only when the next answer is not ready yet.*/
+class queryServer
+{
+public:
+	queryServer(Solver& solver, size_t thrs) :solver(solver), maxPending(64 * std::max<size_t>(thrs, 1))
+	{
+		for (size_t th = 0; th < std::max<size_t>(thrs, 1); th++)
+		{
+			workers.emplace_back([this]() { work(); });
+		}
+	}
+	queryServer(const queryServer&) = delete;
+	queryServer& operator=(const queryServer&) = delete;
+	~queryServer()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto&& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	//answers queries from source until it ends, the answers are written to out
+	void serve(istream& source, ostream& out)
+	{
+		connection c;
+		thread reader([&]()
+			{
+				string line;
+				while (getline(source, line))
+				{
+					unique_lock<mutex> lock(mtx);
+					while (c.submitted - c.written >= maxPending)
 					{
-						areEqual = false;
+						c.condition.wait(lock);
 					}
+					jobs.push({ &c, c.submitted++, std::move(line) });
+					condition.notify_one();
 				}
-				else
+				lock_guard<mutex> lock(mtx);
+				c.reading = false;
+				c.condition.notify_all();
+			});
+
+		unique_lock<mutex> lock(mtx);
+		while (c.reading || c.written != c.submitted)
+		{
+			auto next = c.answers.find(c.written);
+			if (next == c.answers.end())
+			{
+				lock.unlock();
+				out.flush();
+				lock.lock();
+				while (c.answers.count(c.written) == 0 && (c.reading || c.written != c.submitted))
 				{
-					isEnd = true;
+					c.condition.wait(lock);
 				}
-
+				continue;
 			}
-			if (!isEnd)
+			string answer = std::move(next->second);
+			c.answers.erase(next);
+			c.written++;
+			c.condition.notify_all();
+			lock.unlock();
+			out << answer;
+			lock.lock();
+		}
+		lock.unlock();
+		out.flush();
+		reader.join();
+	}
+
+#ifndef _WIN32
+	/*serves every connection to a local socket at path by its own thread, returns only when the socket cannot be created or accepted from,
+	after all connections ended. Errors of one connection or lack of descriptors only delay the next accept.*/
+	bool listen(const string& path)
+	{
+		int server = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (server < 0 || path.size() >= sizeof(address.sun_path))
+		{
+			return false;
+		}
+		memcpy(address.sun_path, path.c_str(), path.size() + 1);
+		unlink(path.c_str());
+		if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(server, 64) != 0)
+		{
+			close(server);
+			return false;
+		}
+		while (true)
+		{
+			int client = accept(server, nullptr, nullptr);
+			if (client < 0)
 			{
-				if (areEqual)
+				if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
 				{
-					cout << "[" << searchedWordsAndIterators.begin()->second->second->id_ << "] ";
-					cout << searchedWordsAndIterators.begin()->second->second->title_ << endl;
-					
-					int x = searchedWordsAndIterators.begin()->second->first;
-					auto path = searchedWordsAndIterators.begin()->second->second;
-					cout << path->words_.substr(x, 75) << "..." << endl;
-
+					continue;
+				}
+				if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+				{
+					this_thread::sleep_for(chrono::milliseconds(100));
+					continue;
 				}
-				for (auto&& item : searchedWordsAndIterators)
+				break;
+			}
+			{
+				lock_guard<mutex> lock(mtx);
+				connections++;
+			}
+			//the count is lowered last, so the server may be destroyed as soon as it drops to zero
+			thread([this, client]()
 				{
-					if (item.second->second->id_ == min)
 					{
-						item.second++;
+						socketBuffer buffer(client);
+						istream in(&buffer);
+						ostream out(&buffer);
+						serve(in, out);
+					}
+					close(client);
+					lock_guard<mutex> lock(mtx);
+					if (--connections == 0)
+					{
+						connectionsDone.notify_all();
 					}
+				}).detach();
+		}
+		close(server);
+		unique_lock<mutex> lock(mtx);
+		while (connections != 0)
+		{
+			connectionsDone.wait(lock);
+		}
+		return false;
+	}
+#endif
+
+private:
+	//answers of one connection which were not written yet, guarded by mtx of the server
+	class connection
+	{
+	public:
+		condition_variable condition;
+		map<uint64_t, string> answers;
+		uint64_t submitted = 0;
+		uint64_t written = 0;
+		bool reading = true;
+	};
+	class job
+	{
+	public:
+		connection* owner;
+		uint64_t sequence;
+		string query;
+	};
+
+#ifndef _WIN32
+	//buffered reading and writing of a connected socket
+	class socketBuffer : public streambuf
+	{
+	public:
+		explicit socketBuffer(int socket) :socket(socket)
+		{
+			setp(output, output + sizeof(output));
+		}
+		~socketBuffer()
+		{
+			sync();
+		}
+	protected:
+		int_type underflow() override
+		{
+			ssize_t n = recv(socket, input, sizeof(input), 0);
+			if (n <= 0)
+			{
+				return traits_type::eof();
+			}
+			setg(input, input, input + n);
+			return traits_type::to_int_type(*gptr());
+		}
+		int_type overflow(int_type c) override
+		{
+			if (sync() != 0)
+			{
+				return traits_type::eof();
+			}
+			if (!traits_type::eq_int_type(c, traits_type::eof()))
+			{
+				*pptr() = traits_type::to_char_type(c);
+				pbump(1);
+			}
+			return traits_type::not_eof(c);
+		}
+		int sync() override
+		{
+			for (char* p = pbase(); p < pptr();)
+			{
+				ssize_t n = send(socket, p, pptr() - p, MSG_NOSIGNAL);
+				if (n <= 0)
+				{
+					setp(output, output + sizeof(output));
+					return -1;
 				}
+				p += n;
 			}
+			setp(output, output + sizeof(output));
+			return 0;
 		}
+	private:
+		int socket;
+		char input[4096];
+		char output[16384];
+	};
+#endif
 
-	}
-	void readCommandsFile(istream& source)
+	void work()
 	{
-		sAndIt_t searchedWordsAndIterators;
-		string line;
-		while (getline(source, line))
+		while (true)
 		{
-
-			bool areAllWordsInAnyArticle = readSearchedWords(line,searchedWordsAndIterators);
-
-			if (areAllWordsInAnyArticle && !searchedWordsAndIterators.empty())
+			job next;
 			{
-				intersection(searchedWordsAndIterators);
-			}
-			else if (!searchedWordsAndIterators.empty()) {
-				cout << "No results" << endl;
+				unique_lock<mutex> lock(mtx);
+				while (jobs.empty() && !stopping)
+				{
+					condition.wait(lock);
+				}
+				if (jobs.empty())
+				{
+					return;
+				}
+				next = std::move(jobs.front());
+				jobs.pop();
 			}
-			searchedWordsAndIterators.clear();
-			cout << endl;
+			ostringstream answer;
+			solver.answer(next.query, answer);
+			lock_guard<mutex> lock(mtx);
+			next.owner->answers.emplace(next.sequence, answer.str());
+			next.owner->condition.notify_all();
 		}
 	}
+
+	Solver& solver;
+	size_t maxPending;
+	vector<thread> workers;
+	queue<job> jobs;
+	mutex mtx;
+	condition_variable condition;
+	bool stopping = false;
+	//threads of connections which did not end yet, listen waits for them
+	size_t connections = 0;
+	condition_variable connectionsDone;
 };
+//FullText_bench.cpp includes this file without main
+#ifndef FULLTEXT_NO_MAIN
 int main(int argc, char** argv)
 {
 	Solver solv;
-	if (argc > 1) {
-		string articles = argv[1];
-		solv.readArticles(articles);
+	vector<string> files;
+	string indexFile;
+	string socketPath;
+	bool server = false;
+	size_t threads = thread::hardware_concurrency();
+	size_t followInterval = 0;
+	size_t shards = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		string argument = argv[i];
+		if (argument == "--index" && i + 1 < argc)
+		{
+			indexFile = argv[++i];
+		}
+		else if (argument == "--top" && i + 1 < argc)
+		{
+			solv.rankedResults = stoul(argv[++i]);
+		}
+		else if (argument == "--threads" && i + 1 < argc)
+		{
+			threads = stoul(argv[++i]);
+		}
+		else if (argument == "--cache" && i + 1 < argc)
+		{
+			solv.cache.setCapacity(stoull(argv[++i]));
+		}
+		else if (argument == "--utf8")
+		{
+			solv.utf8 = true;
+		}
+		else if (argument == "--server")
+		{
+			server = true;
+		}
+		else if (argument == "--socket" && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else if (argument == "--follow" && i + 1 < argc)
+		{
+			followInterval = stoul(argv[++i]);
+		}
+		else if (argument == "--shards" && i + 1 < argc)
+		{
+			shards = stoul(argv[++i]);
+		}
+		else
+		{
+			files.push_back(argument);
+		}
+	}
+	solv.shardQueries(shards, threads);
+	if (files.size() > 0) {
+		string articles = files[0];
+		if (indexFile != "")
+		{
+			solv.openIndex(articles, indexFile, threads);
+		}
+		else
+		{
+			solv.readArticles(articles, threads);
+		}
+		//articles appended to the file while queries are answered are searched too
+		if (followInterval > 0)
+		{
+			solv.follow(articles, chrono::milliseconds(followInterval));
+		}
+	}
+	if (socketPath != "")
+	{
+#ifndef _WIN32
+		queryServer pool(solv, threads);
+		pool.listen(socketPath);
+#endif
+		cerr << "Cannot listen on " << socketPath << endl;
+		return 1;
 	}
 	string commands;
-	if (argc > 2)
+	if (server)
 	{
-		commands = argv[2];
+		queryServer pool(solv, threads);
+		pool.serve(cin, cout);
+	}
+	else if (files.size() > 1)
+	{
+		commands = files[1];
 		ifstream commandsFile(commands);
 		if (commandsFile.is_open()) {
 
@@ -265,7 +4002,12 @@ int main(int argc, char** argv)
 	{
 		solv.readCommandsFile(cin);
 	}
+	if (solv.cache.enabled())
+	{
+		solv.cache.printStatistics(cerr);
+	}
 }
+#endif
 	// Run program: Ctrl + F5 or Debug > Start Without Debugging menu
 	// Debug program: F5 or Debug > Start Debugging menu
 
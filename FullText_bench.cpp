@@ -0,0 +1,232 @@
+// FullText_bench.cpp : measures indexing throughput, size of the index and latency of queries on generated corpora. Prints JSON to the standard output.
+// Usage: FullText_bench [quick]
+//
+
+#define FULLTEXT_NO_MAIN
+#include "FullText.cpp"
+#include <random>
+#include <iomanip>
+
+/*Articles in the format of readArticles, words are drawn from Zipf distribution over the vocabulary - the word of rank r comes with probability
+proportional to 1 / (r + 1)^exponent. The same seed gives the same corpus.*/
+class zipfCorpus
+{
+public:
+	zipfCorpus(size_t vocabularySize, double exponent, uint64_t seed) :random(seed)
+	{
+		double sum = 0;
+		for (size_t rank = 0; rank < vocabularySize; rank++)
+		{
+			sum += 1 / pow(double(rank + 1), exponent);
+			cumulative.push_back(sum);
+		}
+		for (auto&& c : cumulative)
+		{
+			c /= sum;
+		}
+	}
+	//letters of rank in base 26 after w, words are made of letters only so the tokenizer keeps them whole
+	static string word(size_t rank)
+	{
+		string w = "w";
+		do
+		{
+			w += char('a' + rank % 26);
+			rank /= 26;
+		} while (rank != 0);
+		return w;
+	}
+	size_t drawRank()
+	{
+		size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(random)) - cumulative.begin();
+		return std::min(rank, cumulative.size() - 1);
+	}
+	//writes count articles of minWords to maxWords words into file, returns its size
+	uint64_t write(const string& file, size_t count, size_t minWords, size_t maxWords)
+	{
+		ofstream out(file, ios::binary | ios::trunc);
+		uniform_int_distribution<size_t> length(minWords, maxWords);
+		uint64_t size = 0;
+		string text;
+		for (size_t a = 0; a < count; a++)
+		{
+			text = "Z" + to_string(a) + "\nTitle " + to_string(a) + "\n";
+			for (size_t w = length(random); w > 0; w--)
+			{
+				text += word(drawRank());
+				text += w > 1 ? ' ' : '\n';
+			}
+			out << text;
+			size += text.size();
+		}
+		return size;
+	}
+	//distinct words of ranks from first to last (exclusive), as a query
+	string query(size_t terms, size_t first, size_t last)
+	{
+		uniform_int_distribution<size_t> rank(first, std::min(last, cumulative.size()) - 1);
+		set<size_t> chosen;
+		while (chosen.size() < terms)
+		{
+			chosen.insert(rank(random));
+		}
+		string q;
+		for (auto r : chosen)
+		{
+			q += (q.empty() ? "" : " ") + word(r);
+		}
+		return q;
+	}
+
+private:
+	vector<double> cumulative;
+	mt19937_64 random;
+	uniform_real_distribution<double> uniform{ 0, 1 };
+};
+
+//ranks of words which are in many, some or few articles
+class selectivity
+{
+public:
+	string name;
+	size_t first;
+	size_t last;
+};
+
+class latency
+{
+public:
+	double p50;
+	double p90;
+	double p99;
+	double max;
+	double meanResults;
+};
+
+//answers all queries once to warm up and once measured, times are in microseconds
+latency measure(Solver& solver, const vector<string>& queries)
+{
+	vector<double> times;
+	size_t results = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (auto&& q : queries)
+		{
+			ostringstream out;
+			auto start = chrono::steady_clock::now();
+			solver.answer(q, out);
+			chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+			if (pass == 1)
+			{
+				times.push_back(elapsed.count());
+				string answer = out.str();
+				for (size_t line = 0; line < answer.size(); line = answer.find('\n', line) + 1)
+				{
+					results += answer[line] == '[';
+				}
+			}
+		}
+	}
+	std::sort(times.begin(), times.end());
+	auto percentile = [&](double p) { return times[std::min(times.size() - 1, size_t(p * times.size()))]; };
+	return { percentile(0.5), percentile(0.9), percentile(0.99), times.back(), double(results) / queries.size() };
+}
+
+vector<size_t> threadCounts()
+{
+	size_t hardware = std::max<size_t>(thread::hardware_concurrency(), 1);
+	vector<size_t> counts;
+	for (size_t thrs = 1; thrs < hardware; thrs *= 2)
+	{
+		counts.push_back(thrs);
+	}
+	counts.push_back(hardware);
+	return counts;
+}
+
+//rows of one JSON array, each on its own line
+void printArray(const string& name, const vector<string>& rows, bool last)
+{
+	cout << "  \"" << name << "\": [" << '\n';
+	for (size_t i = 0; i < rows.size(); i++)
+	{
+		cout << "    " << rows[i] << (i + 1 < rows.size() ? "," : "") << '\n';
+	}
+	cout << "  ]" << (last ? "" : ",") << '\n';
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = argc > 1 && string(argv[1]) == "quick";
+	size_t articles = quick ? 20000 : 200000;
+	size_t vocabulary = quick ? 50000 : 500000;
+	size_t queryCount = quick ? 100 : 500;
+	double exponent = 1.0;
+	uint64_t seed = 2024;
+	string file = "FullText_bench_corpus.txt";
+
+	zipfCorpus corpus(vocabulary, exponent, seed);
+	uint64_t bytes = corpus.write(file, articles, 50, 300);
+	cout << fixed << setprecision(3) << "{" << '\n';
+	cout << "  \"corpus\": {\"articles\": " << articles << ", \"bytes\": " << bytes << ", \"vocabulary\": " << vocabulary << ", \"zipf_exponent\": "
+		<< exponent << ", \"seed\": " << seed << "}," << '\n';
+
+	vector<string> build;
+	uint64_t indexBytes = 0;
+	for (auto thrs : threadCounts())
+	{
+		Solver solver;
+		auto start = chrono::steady_clock::now();
+		solver.readArticles(file, thrs);
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		indexBytes = solver.indexBytes();
+		ostringstream row;
+		row << fixed << setprecision(3) << "{\"threads\": " << thrs << ", \"seconds\": " << elapsed.count() << ", \"mb_per_s\": " << bytes / 1e6 / elapsed.count() << "}";
+		build.push_back(row.str());
+	}
+	printArray("build", build, false);
+	cout << "  \"index\": {\"bytes\": " << indexBytes << ", \"bytes_per_article\": " << double(indexBytes) / articles << ", \"ratio_to_corpus\": "
+		<< double(indexBytes) / bytes << "}," << '\n';
+
+	//the most common words are in almost all articles, the rarest in a few
+	vector<selectivity> selectivities{ { "common", 0, 16 }, { "medium", 100, 1000 }, { "rare", vocabulary / 10, vocabulary } };
+	size_t hardware = std::max<size_t>(thread::hardware_concurrency(), 1);
+	vector<size_t> shardCounts{ 1 };
+	if (hardware > 1)
+	{
+		shardCounts.push_back(hardware);
+	}
+	vector<string> queries;
+	{
+		Solver solver;
+		solver.readArticles(file, hardware);
+		for (auto shards : shardCounts)
+		{
+			solver.shardQueries(shards, hardware);
+			for (size_t ranked : { 0, 10 })
+			{
+				solver.rankedResults = ranked;
+				for (size_t terms : { 1, 2, 5 })
+				{
+					for (auto&& band : selectivities)
+					{
+						vector<string> generated;
+						for (size_t i = 0; i < queryCount; i++)
+						{
+							generated.push_back(corpus.query(terms, band.first, band.last));
+						}
+						latency l = measure(solver, generated);
+						ostringstream row;
+						row << fixed << setprecision(3) << "{\"mode\": \"" << (ranked > 0 ? "top10" : "all") << "\", \"shards\": " << shards << ", \"terms\": " << terms
+							<< ", \"selectivity\": \"" << band.name << "\", \"queries\": " << generated.size() << ", \"p50_us\": " << l.p50 << ", \"p90_us\": " << l.p90
+							<< ", \"p99_us\": " << l.p99 << ", \"max_us\": " << l.max << ", \"mean_results\": " << l.meanResults << "}";
+						queries.push_back(row.str());
+					}
+				}
+			}
+		}
+	}
+	printArray("queries", queries, true);
+	cout << "}" << endl;
+	remove(file.c_str());
+}
@@ -1,14 +1,323 @@
 #pragma once
 #include <vector>
 #include <queue>
+#include <map>
+#include <chrono>
+#include <limits>
+#include <typeindex>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <memory>
+#include <future>
+#include <list>
+#include <functional>
+#include <array>
+#include <ostream>
 
 #include <thread>
 #include <mutex>
 #include<condition_variable>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
-template<typename ET>
+template<typename ET, std::size_t R = 1>
 class circle;
 
+template<typename ET>
+class runControl;
+
+//Time in seconds which one worker spent computing generations and waiting for halos from its neighbors
+struct workerTimes
+{
+	double compute = 0;
+	double wait = 0;
+};
+
+/*Instrumentation of circle::run which does nothing - all its calls are empty and inlined, so run without trace has no overhead.
+Every instrumentation has class worker with these methods, each thread of the run gets its own object of it.*/
+class noTrace
+{
+public:
+	class worker
+	{
+	public:
+		void assigned(std::size_t) {}
+		void beginWait() {}
+		void endWait() {}
+		void beginCompute() {}
+		void endCompute(std::size_t) {}
+		void exchanged(std::size_t, std::size_t) {}
+	};
+
+	void start(std::size_t) {}
+	worker& at(std::size_t)
+	{
+		return dummy;
+	}
+
+private:
+	worker dummy;
+};
+
+/*Instrumentation which measures each worker of circle::run - time of computing, time of waiting for halos, bytes of exchanged halos and size of its part.
+If events are recorded, every wait and every block of computation is kept and can be exported as Chrome trace (chrome://tracing or Perfetto).*/
+class stencilTrace
+{
+public:
+	class event
+	{
+	public:
+		const char* name;
+		double start;
+		double duration;
+		std::size_t generations;
+	};
+
+	class worker
+	{
+	public:
+		void assigned(std::size_t elements)
+		{
+			cells = elements;
+		}
+		void beginWait()
+		{
+			begin = now();
+		}
+		void endWait()
+		{
+			double end = now();
+			wait += end - begin;
+			record("wait", end, 0);
+		}
+		void beginCompute()
+		{
+			begin = now();
+		}
+		void endCompute(std::size_t count)
+		{
+			double end = now();
+			compute += end - begin;
+			generations += count;
+			record("compute", end, count);
+		}
+		void exchanged(std::size_t sentBytes, std::size_t receivedBytes)
+		{
+			bytesSent += sentBytes;
+			bytesReceived += receivedBytes;
+		}
+
+		std::size_t cells = 0;
+		std::size_t generations = 0;
+		double compute = 0;
+		double wait = 0;
+		std::size_t bytesSent = 0;
+		std::size_t bytesReceived = 0;
+		std::vector<event> events;
+
+	private:
+		friend class stencilTrace;
+
+		double now() const
+		{
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+		}
+		void record(const char* name, double end, std::size_t count)
+		{
+			if (recordEvents)
+			{
+				events.push_back({ name, begin, end - begin, count });
+			}
+		}
+
+		std::chrono::steady_clock::time_point origin;
+		bool recordEvents = true;
+		double begin = 0;
+	};
+
+	//without events only the totals of workers are kept, which is enough for long runs
+	explicit stencilTrace(bool recordEvents = true) :recordEvents(recordEvents) {}
+
+	//called by run before its workers start, results of the previous run are thrown away
+	void start(std::size_t threads)
+	{
+		workers.assign(threads, worker());
+		auto origin = std::chrono::steady_clock::now();
+		for (auto& w : workers)
+		{
+			w.origin = origin;
+			w.recordEvents = recordEvents;
+		}
+	}
+
+	worker& at(std::size_t th)
+	{
+		return workers[th];
+	}
+
+	const std::vector<worker>& threads() const
+	{
+		return workers;
+	}
+
+	/*compute time of the busiest worker divided by the average compute time, 1 means that parts of W and W + 1 elements take the same time.
+	Wait is left out - workers wait for the halos of their neighbors, so a fast worker waits as long as a slow one computes longer and compute
+	plus wait is about the length of the run for all of them.*/
+	double imbalance() const
+	{
+		double longest = 0;
+		double total = 0;
+		for (auto& w : workers)
+		{
+			longest = std::max(longest, w.compute);
+			total += w.compute;
+		}
+		return total == 0 ? 1 : longest * workers.size() / total;
+	}
+
+	//writes events as Chrome trace JSON, one row for each worker, totals of workers are in their metadata
+	void writeChromeTrace(std::ostream& out) const
+	{
+		out << "{\"traceEvents\":[";
+		bool first = true;
+		for (size_t th = 0; th < workers.size(); th++)
+		{
+			const worker& w = workers[th];
+			out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << th
+				<< ",\"args\":{\"name\":\"worker " << th << " (" << w.cells << " cells)\"}}";
+			out << ",\n{\"name\":\"totals\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << th << ",\"ts\":0,\"args\":{\"cells\":" << w.cells
+				<< ",\"generations\":" << w.generations << ",\"compute_s\":" << w.compute << ",\"wait_s\":" << w.wait
+				<< ",\"bytes_sent\":" << w.bytesSent << ",\"bytes_received\":" << w.bytesReceived << "}}";
+			first = false;
+			for (auto& e : w.events)
+			{
+				out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << th << ",\"ts\":" << e.start * 1e6
+					<< ",\"dur\":" << e.duration * 1e6 << ",\"args\":{\"generations\":" << e.generations << "}}";
+			}
+		}
+		out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"compute_imbalance\":" << imbalance() << "}}\n";
+	}
+
+private:
+	bool recordEvents;
+	std::vector<worker> workers;
+};
+
+//Read only view of values of the neighbours of one cell, which is given to the functor.
+template<typename ET>
+class cellView
+{
+public:
+	cellView(const ET* first, std::size_t count) :first(first), count(count) {}
+
+	const ET& operator[](std::size_t index) const
+	{
+		return first[index];
+	}
+	std::size_t size() const
+	{
+		return count;
+	}
+	const ET* begin() const
+	{
+		return first;
+	}
+	const ET* end() const
+	{
+		return first + count;
+	}
+
+private:
+	const ET* first;
+	std::size_t count;
+};
+
+/*Allocator which leaves new elements default initialized (so trivial types are not written at all). Pages of a vector allocated by one thread
+are then first touched by the threads which write to them, which places them on their NUMA nodes.*/
+template<typename T>
+class firstTouchAllocator
+{
+public:
+	using value_type = T;
+
+	firstTouchAllocator() = default;
+	template<typename U>
+	firstTouchAllocator(const firstTouchAllocator<U>&) {}
+
+	T* allocate(std::size_t n)
+	{
+		return std::allocator<T>().allocate(n);
+	}
+	void deallocate(T* p, std::size_t n)
+	{
+		std::allocator<T>().deallocate(p, n);
+	}
+	template<typename U>
+	void construct(U* p)
+	{
+		::new(static_cast<void*>(p)) U;
+	}
+	template<typename U, typename ... Args>
+	void construct(U* p, Args&& ... args)
+	{
+		::new(static_cast<void*>(p)) U(std::forward<Args>(args) ...);
+	}
+
+	template<typename U>
+	bool operator==(const firstTouchAllocator<U>&) const
+	{
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const firstTouchAllocator<U>&) const
+	{
+		return false;
+	}
+};
+
+template<typename ET>
+using field_t = std::vector<ET, firstTouchAllocator<ET>>;
+
+//Returns cores on which this process may run, workers are pinned to them in this order. Empty if pinning is not supported.
+inline std::vector<int> availableCores()
+{
+	std::vector<int> cores;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (int core = 0; core < CPU_SETSIZE; core++)
+		{
+			if (CPU_ISSET(core, &set))
+			{
+				cores.push_back(core);
+			}
+		}
+	}
+#endif
+	return cores;
+}
+
+//Pins calling thread to given core, negative core means no pinning. Failure is ignored, the thread just stays unpinned.
+inline void pinToCore(int core)
+{
+#ifdef __linux__
+	if (core >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#else
+	(void)core;
+#endif
+}
+
 //Contains three components for exchange channels between threads. 
 template<typename ET>
 class package
@@ -20,23 +329,443 @@ public:
 };
 
 //Functor which enables calling member function I had some errors with direct calling (member function)
-template<typename ET, typename SF>
+template<typename ET, typename SF, std::size_t R, typename Control, typename Instrument>
 class forwarder
 {
 public:
-	void operator()(void* context, typename std::vector<ET>::iterator beg, typename std::vector<ET>::iterator end, size_t G, SF& sf, size_t g, size_t index,
-		size_t threads, typename std::vector<ET>::iterator res
-		, package<ET>& toLeft, package<ET>& toRight, package<ET>& fromLeft, package<ET>& fromRight, std::mutex& mutexToWriteData)
+	void operator()(void* context, typename field_t<ET>::iterator beg, typename field_t<ET>::iterator end, size_t G, SF& sf, size_t g, size_t index,
+		int core, typename field_t<ET>::iterator res
+		, package<ET>& toLeft, package<ET>& toRight, package<ET>& fromLeft, package<ET>& fromRight, Control& control, Instrument& instrument)
+	{
+		static_cast<circle<ET, R>*>(context)->oneThreadComputing(beg, end, G, sf, g, index, core, res, toLeft, toRight, fromLeft, fromRight, control, instrument);
+	}
+};
+
+/*Control of run which lets workers compute all generations. Every control has these two methods - reach is called at the start of each block
+(and once at the end) with the part of the worker, blockDone after each block with its previous and current generation. Worker stops when one returns false.
+Parts are given by pointers, or by iterators for bool whose vector has no data().*/
+class noControl
+{
+public:
+	template<typename It>
+	bool reach(std::size_t, std::size_t, It, std::size_t, std::size_t)
+	{
+		return true;
+	}
+	template<typename It>
+	bool blockDone(std::size_t, std::size_t, It, It, std::size_t)
+	{
+		return true;
+	}
+};
+
+//Copy of the whole field after given number of generations
+template<typename ET>
+class snapshot
+{
+public:
+	std::size_t generation;
+	std::vector<ET> field;
+};
+
+/*Shared state of one asynchronous run. Workers report to it at the start of every block of generations (and once at the end), which gives progress
+and lets them agree on the block boundary where to stop or where to copy their parts to a snapshot. The boundary requested by cancel or snapshot
+is always the first one which no worker has reached yet, so all workers see it and no one has to wait for the others.*/
+template<typename ET>
+class runControl
+{
+public:
+	runControl(std::size_t threads, std::size_t total, std::size_t G) :reached(threads, 0), stopAt(total), G(G) {}
+
+	/*called by worker which has computed given number of generations, part is its part of the field in that moment. Fills the part of snapshots requested
+	at this boundary and returns false if the worker should stop here.*/
+	template<typename It>
+	bool reach(std::size_t th, std::size_t generation, It part, std::size_t offset, std::size_t length)
+	{
+		std::vector<pendingSnapshot*> toFill;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			reached[th] = generation;
+			if (generation >= stopAt)
+			{
+				return false;
+			}
+			for (auto& pending : snapshots)
+			{
+				if (pending.result.generation == generation)
+				{
+					toFill.push_back(&pending);
+				}
+			}
+		}
+		//parts of workers are disjoint, so they are copied without lock - except bools, whose parts may share a word of the packed vector
+		for (auto pending : toFill)
+		{
+			if constexpr (std::is_same_v<ET, bool>)
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				std::copy(part, part + length, pending->result.field.begin() + offset);
+			}
+			else
+			{
+				std::copy(part, part + length, pending->result.field.begin() + offset);
+			}
+		}
+		if (!toFill.empty())
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			for (auto pending : toFill)
+			{
+				if (--pending->remaining == 0)
+				{
+					pending->promise.set_value(std::move(pending->result));
+				}
+			}
+			snapshots.remove_if([](const pendingSnapshot& pending) { return pending.remaining == 0; });
+		}
+		return true;
+	}
+
+	//async run never stops after a block by itself
+	template<typename It>
+	bool blockDone(std::size_t, std::size_t, It, It, std::size_t)
+	{
+		return true;
+	}
+
+	//called once all workers ended, snapshots at the last boundary (and all later ones) are copies of the final field returned by readField
+	void finish(std::function<std::vector<ET>()> readField)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		finalField = std::move(readField);
+		for (auto& pending : snapshots)
+		{
+			pending.promise.set_value(snapshot<ET>{ stopAt, finalField() });
+		}
+		snapshots.clear();
+		finished = true;
+	}
+
+	//number of generations which all workers have computed
+	std::size_t completed() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return *std::min_element(reached.begin(), reached.end());
+	}
+
+	//workers stop at the first boundary no one has reached yet, the field then contains this generation
+	void cancel()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopAt = std::min(stopAt, *std::max_element(reached.begin(), reached.end()) + G);
+		for (auto& pending : snapshots)
+		{
+			pending.result.generation = std::min(pending.result.generation, stopAt);
+		}
+	}
+
+	std::future<snapshot<ET>> requestSnapshot(std::size_t size)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		snapshots.emplace_back();
+		pendingSnapshot& pending = snapshots.back();
+		pending.result.generation = std::min(stopAt, *std::max_element(reached.begin(), reached.end()) + G);
+		pending.result.field.resize(size);
+		pending.remaining = reached.size();
+		auto future = pending.promise.get_future();
+		if (finished)
+		{
+			pending.promise.set_value(snapshot<ET>{ stopAt, finalField() });
+			snapshots.pop_back();
+		}
+		return future;
+	}
+
+	bool done() const
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		return finished;
+	}
+
+private:
+	//snapshot at the last boundary (stopAt) is not filled by workers, finish copies the final field instead
+	class pendingSnapshot
+	{
+	public:
+		snapshot<ET> result;
+		std::size_t remaining = 0;
+		std::promise<snapshot<ET>> promise;
+	};
+
+	mutable std::mutex mtx;
+	std::vector<std::size_t> reached;
+	std::size_t stopAt;
+	std::size_t G;
+	std::list<pendingSnapshot> snapshots;
+	std::function<std::vector<ET>()> finalField;
+	bool finished = false;
+};
+
+/*Reduction over all cells of the field - cell(previous, current) gives value of one cell from its last two generations,
+combine joins two values and identity is the value of no cells. For example maximal change is (0, |current - previous|, max).*/
+template<typename V, typename Cell, typename Combine>
+class reduction
+{
+public:
+	V identity;
+	Cell cell;
+	Combine combine;
+};
+
+template<typename V, typename Cell, typename Combine>
+reduction<V, Cell, Combine> makeReduction(V identity, Cell cell, Combine combine)
+{
+	return reduction<V, Cell, Combine>{ identity, cell, combine };
+}
+
+//Result of circle::runUntil - how many generations were computed and the reduced value after the last of them
+template<typename V>
+class convergence
+{
+public:
+	std::size_t generations;
+	V value;
+};
+
+/*Control of circle::runUntil. After each block every worker reduces its part, the values are combined along a binary tree (worker th waits for th + 1,
+th + 2, th + 4 ... while th is divisible by twice the step, then hands its value to its parent) and worker 0 decides by the predicate for all.*/
+template<typename ET, typename V, typename Cell, typename Combine, typename Predicate>
+class treeReduction
+{
+public:
+	treeReduction(std::size_t threads, const reduction<V, Cell, Combine>& r, Predicate predicate) :slots(threads), r(r), predicate(predicate),
+		result{ 0, r.identity } {}
+
+	template<typename It>
+	bool reach(std::size_t, std::size_t, It, std::size_t, std::size_t)
+	{
+		return true;
+	}
+
+	template<typename It>
+	bool blockDone(std::size_t th, std::size_t generation, It previous, It current, std::size_t length)
+	{
+		V value = r.identity;
+		for (size_t i = 0; i < length; i++)
+		{
+			value = r.combine(value, r.cell(previous[i], current[i]));
+		}
+
+		size_t round = slots[th].round + 1;
+		for (size_t step = 1; step < slots.size(); step *= 2)
+		{
+			if (th % (2 * step) != 0)
+			{
+				//hands the value of its subtree to the parent
+				{
+					std::lock_guard<std::mutex> lock(slots[th].mtx);
+					slots[th].value = value;
+					slots[th].round = round;
+				}
+				slots[th].condition.notify_one();
+				break;
+			}
+			if (th + step < slots.size())
+			{
+				slot& child = slots[th + step];
+				std::unique_lock<std::mutex> lock(child.mtx);
+				while (child.round != round)
+				{
+					child.condition.wait(lock);
+				}
+				value = r.combine(value, child.value);
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(mtx);
+		if (th == 0)
+		{
+			slots[0].round = round;
+			result = convergence<V>{ generation, value };
+			stop = predicate(value);
+			decided = round;
+			condition.notify_all();
+		}
+		while (decided != round)
+		{
+			condition.wait(lock);
+		}
+		return !stop;
+	}
+
+	convergence<V> last() const
 	{
-		static_cast<circle<ET>*>(context)->oneThreadComputing(beg, end, G, sf, g, index, threads, res, toLeft, toRight, fromLeft, fromRight, mutexToWriteData);
+		return result;
 	}
+
+private:
+	//value of the subtree of one worker, round is the number of blocks for which it was given
+	class slot
+	{
+	public:
+		std::mutex mtx;
+		std::condition_variable condition;
+		V value;
+		std::size_t round = 0;
+	};
+
+	std::vector<slot> slots;
+	reduction<V, Cell, Combine> r;
+	Predicate predicate;
+	std::mutex mtx;
+	std::condition_variable condition;
+	std::size_t decided = 0;
+	bool stop = false;
+	//value of no generation is the identity, it stays when none is computed
+	convergence<V> result;
 };
 
+//Returned by circle::runAsync. Destructor waits for the run, the circle must not be used until then and must live as long as the handle.
 template<typename ET>
+class runHandle
+{
+public:
+	runHandle(std::shared_ptr<runControl<ET>> control, std::thread&& runner, std::size_t size) :control(std::move(control)), runner(std::move(runner)), size(size) {}
+	runHandle(runHandle&&) = default;
+	runHandle& operator=(runHandle&& other)
+	{
+		wait();
+		control = std::move(other.control);
+		runner = std::move(other.runner);
+		size = other.size;
+		return *this;
+	}
+	~runHandle()
+	{
+		wait();
+	}
+
+	//number of generations which are computed on the whole field
+	std::size_t completed() const
+	{
+		return control->completed();
+	}
+
+	bool finished() const
+	{
+		return control->done();
+	}
+
+	//stops the run at the nearest block boundary, the field then contains that generation
+	void cancel()
+	{
+		control->cancel();
+	}
+
+	//consistent copy of the field at the nearest block boundary, workers do not stop for it
+	std::future<snapshot<ET>> takeSnapshot()
+	{
+		return control->requestSnapshot(size);
+	}
+
+	void wait()
+	{
+		if (runner.joinable())
+		{
+			runner.join();
+		}
+	}
+
+private:
+	std::shared_ptr<runControl<ET>> control;
+	std::thread runner;
+	std::size_t size;
+};
+
+//Computation of generations shared by the stencils. Storage contains the computed part with halo of G * R elements on both sides.
+template<typename ET, std::size_t R>
+class stencilKernel
+{
+public:
+	/*calls the functor on 2R+1 values starting with window, which are stride elements apart (stride is not 1 in structure of arrays layout).
+	Window is a pointer, or an iterator of vector<bool> whose values are gathered for cellView.*/
+	template<typename SF, typename It>
+	static ET apply(SF& sf, It window, std::size_t stride = 1)
+	{
+		if constexpr (acceptsValues<SF>(std::make_index_sequence<2 * R + 1>()))
+		{
+			return applyValues(sf, window, stride, std::make_index_sequence<2 * R + 1>());
+		}
+		else
+		{
+			if constexpr (std::is_pointer_v<It>)
+			{
+				if (stride == 1)
+				{
+					return sf(cellView<ET>(window, 2 * R + 1));
+				}
+			}
+			std::array<ET, 2 * R + 1> values;
+			for (size_t i = 0; i < values.size(); i++)
+			{
+				values[i] = window[i * stride];
+			}
+			return sf(cellView<ET>(values.data(), values.size()));
+		}
+	}
+
+	//computes count (at most G) generations. In each generation it computes only valid part of the vector, which shrinks by R on both sides.
+	template<typename SF>
+	static void generations(SF& sf, std::vector<ET>& storage, std::vector<ET>& secondaryStorage, std::size_t count)
+	{
+		for (size_t i = 1; i <= count; i++)
+		{
+			for (size_t j = i * R; j < storage.size() - i * R; j++)
+			{
+				secondaryStorage[j] = apply(sf, at(storage, j - R));
+			}
+			std::swap(secondaryStorage, storage);
+		}
+	}
+
+	//element index of storage as a pointer, vector<bool> has no data() so it gives an iterator
+	template<typename Vector>
+	static auto at(Vector& storage, std::size_t index)
+	{
+		if constexpr (std::is_same_v<ET, bool>)
+		{
+			return storage.begin() + index;
+		}
+		else
+		{
+			return storage.data() + index;
+		}
+	}
+
+private:
+	template<std::size_t>
+	using value_t = const ET&;
+
+	template<typename SF, std::size_t ... I>
+	static constexpr bool acceptsValues(std::index_sequence<I ...>)
+	{
+		return std::is_invocable_v<SF&, value_t<I> ...>;
+	}
+
+	template<typename SF, typename It, std::size_t ... I>
+	static ET applyValues(SF& sf, It window, std::size_t stride, std::index_sequence<I ...>)
+	{
+		return sf(window[I * stride] ...);
+	}
+};
+
+/*Field of the stencil - ring of elements. The functor gets 2R+1 values centered on the computed cell, either as 2R+1 arguments
+(sf(left, center, right) for the default R = 1) or as one cellView, whichever it accepts.*/
+template<typename ET, std::size_t R>
 class circle
 {
 public:
-	circle(std::size_t s) :field(std::vector<ET>(s)) {}
+	circle(std::size_t s) :field(s, ET()) {}
 
 	std::size_t size() const
 	{
@@ -57,85 +786,197 @@ public:
 		return field[index];
 	}
 
-	//run divides the field to threads and calls oneThreadComputing on each of them
+	/*Parameters of one run - how many generations are computed between two halo exchanges, how many threads share the field and whether they are pinned
+	to cores. Pinning is asked for, because two runs at once in one process would pin their workers to the same cores.*/
+	struct configuration
+	{
+		std::size_t generationsBlock;
+		std::size_t threads;
+		bool pinned = false;
+	};
+
+	//run divides the field to threads and calls oneThreadComputing on each of them, G is W / 32
 	template<typename SF>
 	void run(SF&& sf, std::size_t g, std::size_t thrs = std::thread::hardware_concurrency())
 	{
-		std::vector<package<ET>> toLeft(thrs);
-		std::vector<package<ET>> toRight(thrs);
+		run(sf, g, configuration{ defaultBlock(size(), thrs), thrs });
+	}
 
-		std::mutex mutexToWriteData;
-		std::vector<ET> result(size());
+	//same as above, but with explicitly given G, for example the one found by autotune
+	template<typename SF>
+	void run(SF&& sf, std::size_t g, const configuration& config)
+	{
+		noControl control;
+		noTrace none;
+		runControlled(sf, g, config, control, none);
+	}
 
-		typename std::vector<ET>::iterator startOfResult = result.begin();
-		typename std::vector<ET>::iterator startingPosition = field.begin();
+	//same as run, but every worker is measured by the trace
+	template<typename SF>
+	void runTraced(SF&& sf, std::size_t g, const configuration& config, stencilTrace& trace)
+	{
+		noControl control;
+		runControlled(sf, g, config, control, trace);
+	}
 
-		std::vector<std::thread> workers;
-		size_t W = size() / thrs;
-		size_t G = W / 32;
-		if (G == 0) { G = 1; }
+	//same as run, but measures how long each worker computed and how long it waited for halos
+	template<typename SF>
+	std::vector<workerTimes> runMeasured(SF&& sf, std::size_t g, const configuration& config)
+	{
+		stencilTrace trace(false);
+		runTraced(sf, g, config, trace);
+		std::vector<workerTimes> times;
+		for (auto& w : trace.threads())
+		{
+			times.push_back({ w.compute, w.wait });
+		}
+		return times;
+	}
 
-		for (size_t th = 0; th < thrs; th++)
+	/*starts run in background and returns immediately, the handle reports progress, cancels the run and takes snapshots of the field.
+	The functor is copied, because the caller may not outlive the run.*/
+	template<typename SF>
+	runHandle<ET> runAsync(SF sf, std::size_t g, std::size_t thrs = std::thread::hardware_concurrency())
+	{
+		configuration config{ defaultBlock(size(), thrs), thrs };
+		size_t s = size();
+		auto control = std::make_shared<runControl<ET>>(thrs, g, config.generationsBlock);
+		std::thread runner([this, sf = std::move(sf), g, config, control]() mutable
+			{
+				noTrace none;
+				runControlled(sf, g, config, *control, none);
+				control->finish([this]() { return std::vector<ET>(field.begin(), field.end()); });
+			});
+		return runHandle<ET>(control, std::move(runner), s);
+	}
+
+	/*runs until the predicate holds for the reduction of the field, but at most maxG generations. Returns number of computed generations and the last
+	reduced value. The predicate is checked after every generation, so G is 1 - workers exchange halos and meet in the reduction every generation,
+	which makes a generation slower than in run.*/
+	template<typename SF, typename V, typename Cell, typename Combine, typename Predicate>
+	convergence<V> runUntil(SF&& sf, const reduction<V, Cell, Combine>& r, Predicate predicate, std::size_t maxG,
+		std::size_t thrs = std::thread::hardware_concurrency())
+	{
+		configuration config{ 1, thrs };
+		treeReduction<ET, V, Cell, Combine, Predicate> control(thrs, r, predicate);
+		noTrace none;
+		runControlled(sf, maxG, config, control, none);
+		return control.last();
+	}
+
+	/*runTuned is run which chooses G and number of threads by itself. First calls with the same (size, functor) are split into short trials, each of them
+	computed with one candidate configuration and timed, so no generation is wasted. Once every candidate was measured, the fastest one is cached and used.*/
+	template<typename SF>
+	void runTuned(SF&& sf, std::size_t g)
+	{
+		tuningKey key{ size(), std::type_index(typeid(std::decay_t<SF>)) };
+		while (g > 0)
 		{
-			if (size() % thrs > th)
+			configuration config;
+			size_t candidate;
+			bool measuring;
 			{
-				workers.push_back(std::thread(forwarder<ET, SF>(), this, startingPosition, startingPosition + W + 1, G, std::ref(sf), g, th, thrs, startOfResult
-					, std::ref(toLeft[th]), std::ref(toRight[th]), std::ref(toRight[(th - 1 + thrs) % thrs]), std::ref(toLeft[(th + 1) % thrs]), std::ref(mutexToWriteData)
-				));
-				startingPosition += (W + 1);
-				startOfResult += (W + 1);
+				std::lock_guard<std::mutex> lock(tuning().mtx);
+				tuningEntry& entry = entryFor(key);
+				measuring = !entry.finished();
+				if (measuring)
+				{
+					candidate = entry.nextCandidate;
+					config = entry.candidates[candidate];
+				}
+				else
+				{
+					config = entry.best;
+				}
 			}
-			else
+			if (!measuring)
 			{
-				workers.push_back(std::thread(forwarder<ET, SF>(), this, startingPosition, startingPosition + W, G, std::ref(sf), g, th, thrs, startOfResult
-					, std::ref(toLeft[th]), std::ref(toRight[th]), std::ref(toRight[(th - 1 + thrs) % thrs]), std::ref(toLeft[(th + 1) % thrs]), std::ref(mutexToWriteData)
-				));
-				startingPosition += W;
-				startOfResult += W;
+				run(sf, g, config);
+				return;
+			}
+
+			size_t trial = std::min(g, trialGenerations(config));
+			auto start = std::chrono::steady_clock::now();
+			run(sf, trial, config);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			g -= trial;
+			{
+				std::lock_guard<std::mutex> lock(tuning().mtx);
+				entryFor(key).record(candidate, elapsed.count() / trial, size());
 			}
 		}
-		for (auto& t : workers)
+	}
+
+	//offline variant of tuning - measures all candidates on a copy of the field, so the field itself does not change. Returns the chosen configuration.
+	template<typename SF>
+	configuration autotune(SF&& sf, std::size_t generationsPerTrial = 0)
+	{
+		tuningKey key{ size(), std::type_index(typeid(std::decay_t<SF>)) };
+		circle scratch(*this);
+		while (true)
 		{
-			t.join();
+			configuration config;
+			{
+				std::lock_guard<std::mutex> lock(tuning().mtx);
+				tuningEntry& entry = entryFor(key);
+				if (entry.finished())
+				{
+					return entry.best;
+				}
+				config = entry.candidates[entry.nextCandidate];
+			}
+			scratch.runTuned(sf, generationsPerTrial == 0 ? trialGenerations(config) : generationsPerTrial);
 		}
-		field = std::move(result);
 	}
-	//this is the function which is done by each thread. First it sends messages to its neighbors, then recieves from them and then does G (or less) generations. 
-	template<typename SF>
-	void oneThreadComputing(typename std::vector<ET>::iterator beg, typename std::vector<ET>::iterator end, size_t generationsBlock, SF& sf, size_t generationsTotal, size_t index, size_t threads,
-		typename std::vector<ET>::iterator res, package<ET>& toLeft, package<ET>& toRight, package<ET>& fromLeft, package<ET>& fromRight, std::mutex& mutexToWriteData)
+
+	/*this is the function which is done by each thread. First it sends messages to its neighbors, then recieves from them and then does G (or less) generations.
+	Storage is one vector - G * R elements recieved from left neighbor, part of this thread and G * R elements recieved from right neighbor.
+	A pinned thread is pinned before it allocates anything, so its storage is on its own NUMA node. The thread reports to control at the start and at the end
+	of each block and stops where it says (noControl never stops it). Instrument is told about every wait and computation (noTrace::worker ignores them).*/
+	template<typename SF, typename Control, typename Instrument>
+	void oneThreadComputing(typename field_t<ET>::iterator beg, typename field_t<ET>::iterator end, size_t generationsBlock, SF& sf, size_t generationsTotal, size_t index, int core,
+		typename field_t<ET>::iterator res, package<ET>& toLeft, package<ET>& toRight, package<ET>& fromLeft, package<ET>& fromRight, Control& control, Instrument& instrument)
 	{
-		threeVectors storage;
-		storage.thisPart = std::vector(beg, end);
+		pinToCore(core);
+		size_t halo = generationsBlock * R;
+		size_t part = end - beg;
+		instrument.assigned(part);
+		std::vector<ET> storage(halo + part + halo);
+		std::copy(beg, end, storage.begin() + halo);
 
-		//Creates second threeVectors, set them on correct sizes, allocates once
-		threeVectors secondaryStorage;
-		secondaryStorage.leftG = std::vector<ET>(generationsBlock);
-		secondaryStorage.thisPart = std::vector<ET>(storage.thisPart.size());
-		secondaryStorage.rightG = std::vector<ET>(generationsBlock);
+		//second storage of the same size, allocates once
+		std::vector<ET> secondaryStorage(storage.size());
+		size_t offset = beg - field.begin();
+		bool stopped = false;
 		for (size_t generationIndex = 0; generationIndex < generationsTotal; generationIndex += generationsBlock)
 		{
+			if (!control.reach(index, generationIndex, stencilKernel<ET, R>::at(storage, halo), offset, part))
+			{
+				stopped = true;
+				break;
+			}
 
 			//sending
 			{
 				std::lock_guard<std::mutex> lock(toLeft.mtx);
-				toLeft.channel.push(std::vector<ET>(storage.thisPart.begin(), storage.thisPart.begin() + generationsBlock));
+				toLeft.channel.push(std::vector<ET>(storage.begin() + halo, storage.begin() + 2 * halo));
 			}
 			toLeft.condition.notify_one();
 
 			{
 				std::lock_guard<std::mutex> lock(toRight.mtx);
-				toRight.channel.push(std::vector<ET>(storage.thisPart.end() - generationsBlock, storage.thisPart.end()));
+				toRight.channel.push(std::vector<ET>(storage.begin() + part, storage.begin() + part + halo));
 			}
 			toRight.condition.notify_one();
 			//recieving
+			instrument.beginWait();
 			{
 				std::unique_lock<std::mutex> lock(fromRight.mtx);
 				while (fromRight.channel.empty())
 				{
 					fromRight.condition.wait(lock);
 				}
-				storage.rightG = std::move(fromRight.channel.front());
+				std::copy(fromRight.channel.front().begin(), fromRight.channel.front().end(), storage.begin() + halo + part);
 				fromRight.channel.pop();
 			}
 			{
@@ -144,62 +985,223 @@ public:
 				{
 					fromLeft.condition.wait(lock);
 				}
-				storage.leftG = std::move(fromLeft.channel.front());
+				std::copy(fromLeft.channel.front().begin(), fromLeft.channel.front().end(), storage.begin());
 				fromLeft.channel.pop();
 			}
-			/*computing generationsBlock (or less if generationsTotal is not divisible by generationsBlock) generations. 
-			In each generation it computes only valid part of the vector. */
-			for (size_t i = 1; i <= generationsBlock && i + generationIndex <= generationsTotal; i++)
+			instrument.endWait();
+			instrument.exchanged(2 * halo * sizeof(ET), 2 * halo * sizeof(ET));
+
+			//computing generationsBlock (or less if generationsTotal is not divisible by generationsBlock) generations
+			size_t count = std::min(generationsBlock, generationsTotal - generationIndex);
+			instrument.beginCompute();
+			stencilKernel<ET, R>::generations(sf, storage, secondaryStorage, count);
+			instrument.endCompute(count);
+
+			//after the swap secondaryStorage contains the previous generation
+			if (!control.blockDone(index, generationIndex + count, stencilKernel<ET, R>::at(secondaryStorage, halo), stencilKernel<ET, R>::at(storage, halo), part))
 			{
-				for (size_t j = i; j < storage.size() - i; j++)
-				{
-					secondaryStorage[j] = sf(storage[j - 1], storage[j], storage[j + 1]);
-				}
-				std::swap(secondaryStorage, storage);
+				stopped = true;
+				break;
 			}
 		}
-		//writes to result, which then will be moved to original vector once all threads finish
+		if (!stopped)
+		{
+			control.reach(index, generationsTotal, stencilKernel<ET, R>::at(storage, halo), offset, part);
+		}
+		//writes to result, which then will be moved to original vector once all threads finish. Parts of the threads are disjoint, so no lock is needed -
+		//except for bools, where neighbouring parts may share a word of the packed vector.
+		if constexpr (std::is_same_v<ET, bool>)
 		{
-			std::unique_lock<std::mutex> lock(mutexToWriteData);
-			for (size_t i = 0; i < storage.thisPart.size(); i++)
+			static std::mutex packedResult;
+			std::lock_guard<std::mutex> lock(packedResult);
+			std::copy(storage.begin() + halo, storage.begin() + halo + part, res);
+		}
+		else
+		{
+			std::copy(storage.begin() + halo, storage.begin() + halo + part, res);
+		}
+	}
+
+private:
+	//body of run, control is noControl except for runAsync and runUntil, trace is noTrace except for runTraced
+	template<typename SF, typename Control, typename Trace>
+	void runControlled(SF& sf, std::size_t g, const configuration& config, Control& control, Trace& trace)
+	{
+		size_t thrs = config.threads;
+		trace.start(thrs);
+		std::vector<package<ET>> toLeft(thrs);
+		std::vector<package<ET>> toRight(thrs);
+
+		//result is not initialized here, each part of it is first touched by the worker which computes it
+		field_t<ET> result(size());
+		std::vector<int> cores;
+		if (config.pinned)
+		{
+			cores = availableCores();
+		}
+
+		typename field_t<ET>::iterator startOfResult = result.begin();
+		typename field_t<ET>::iterator startingPosition = field.begin();
+
+		std::vector<std::thread> workers;
+		size_t W = size() / thrs;
+		size_t G = config.generationsBlock;
+
+		for (size_t th = 0; th < thrs; th++)
+		{
+			int core = cores.empty() ? -1 : cores[th % cores.size()];
+			if (size() % thrs > th)
 			{
-				*(res + i) = storage[i + storage.leftG.size()];
+				workers.push_back(std::thread(forwarder<ET, SF, R, Control, typename Trace::worker>(), this, startingPosition, startingPosition + W + 1, G, std::ref(sf), g, th, core, startOfResult
+					, std::ref(toLeft[th]), std::ref(toRight[th]), std::ref(toRight[(th - 1 + thrs) % thrs]), std::ref(toLeft[(th + 1) % thrs]), std::ref(control)
+					, std::ref(trace.at(th))
+				));
+				startingPosition += (W + 1);
+				startOfResult += (W + 1);
+			}
+			else
+			{
+				workers.push_back(std::thread(forwarder<ET, SF, R, Control, typename Trace::worker>(), this, startingPosition, startingPosition + W, G, std::ref(sf), g, th, core, startOfResult
+					, std::ref(toLeft[th]), std::ref(toRight[th]), std::ref(toRight[(th - 1 + thrs) % thrs]), std::ref(toLeft[(th + 1) % thrs]), std::ref(control)
+					, std::ref(trace.at(th))
+				));
+				startingPosition += W;
+				startOfResult += W;
 			}
 		}
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+		field = std::move(result);
 	}
 
-	/*each thread creates two of this object. This class contains three parts - leftG will be recieved from left neighbor, thisPart is computed by this thread
-	and rightG will be recieved from right neighbor. It can be indexed without knowing how the parts are divided.*/
-	class threeVectors
+	//default G used by run without configuration, G = W / 32 / R, at least 1
+	static std::size_t defaultBlock(std::size_t size, std::size_t thrs)
+	{
+		size_t G = size / thrs / 32 / R;
+		if (G == 0) { G = 1; }
+		return G;
+	}
+
+	//each trial contains at least two exchanges of halos, so the price of synchronization is part of the measurement
+	static std::size_t trialGenerations(const configuration& config)
+	{
+		return std::max<std::size_t>(2 * config.generationsBlock, 16);
+	}
+
+	using tuningKey = std::pair<std::size_t, std::type_index>;
+
+	/*State of tuning for one key. Tuning has two stages - first number of threads is chosen (with default G), then G for that number of threads.
+	Candidates of each stage are measured one after another and the best one is kept.*/
+	class tuningEntry
 	{
 	public:
-		decltype(auto) operator[](size_t index)
+		bool finished() const
+		{
+			return stage == 2;
+		}
+		//stores time per generation of given candidate, trials of candidates which were already measured by someone else are ignored
+		void record(std::size_t candidate, double secondsPerGeneration, std::size_t size)
 		{
-			if (index < leftG.size())
+			if (candidate != nextCandidate || finished())
 			{
-				return leftG[index];
+				return;
 			}
-			else if (index < leftG.size() + thisPart.size())
+			if (secondsPerGeneration < bestTime)
 			{
-				return thisPart[index - leftG.size()];
+				bestTime = secondsPerGeneration;
+				best = candidates[candidate];
 			}
-			else
+			nextCandidate++;
+			if (nextCandidate == candidates.size())
 			{
-				return rightG[index - leftG.size() - thisPart.size()];
+				stage++;
+				nextCandidate = 0;
+				candidates = stage == 1 ? blockCandidates(size, best.threads) : std::vector<configuration>();
+				if (candidates.empty())
+				{
+					stage = 2;
+				}
 			}
+		}
+
+		std::vector<configuration> candidates;
+		std::size_t nextCandidate = 0;
+		int stage = 0;
+		configuration best{ 1, 1 };
+		double bestTime = std::numeric_limits<double>::infinity();
+	};
 
+	//candidates of the first stage: 1, 2, 4 ... threads up to hardware_concurrency (which is always included), each thread has at least R elements
+	static std::vector<configuration> threadCandidates(std::size_t size)
+	{
+		size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+		std::vector<size_t> counts;
+		for (size_t thrs = 1; thrs < hardware; thrs *= 2)
+		{
+			counts.push_back(thrs);
+		}
+		counts.push_back(hardware);
+
+		std::vector<configuration> candidates;
+		for (auto thrs : counts)
+		{
+			if (thrs * R <= size)
+			{
+				candidates.push_back({ defaultBlock(size, thrs), thrs });
+			}
 		}
-		size_t size()
+		return candidates;
+	}
+
+	//candidates of the second stage: G = 1, 4, 16 ... up to W / 4 / R except the default, halos (G * R) are never longer than the smallest part
+	static std::vector<configuration> blockCandidates(std::size_t size, std::size_t thrs)
+	{
+		size_t W = size / thrs;
+		size_t defaultG = defaultBlock(size, thrs);
+		std::vector<configuration> candidates;
+		for (size_t G = 1; G <= std::max<size_t>(W / 4 / R, 1) && G * R <= W; G *= 4)
 		{
-			return leftG.size() + thisPart.size() + rightG.size();
+			if (G != defaultG)
+			{
+				candidates.push_back({ G, thrs });
+			}
 		}
-		std::vector<ET> leftG;
-		std::vector<ET> thisPart;
-		std::vector<ET> rightG;
+		return candidates;
+	}
+
+	//results of tuning are shared by all circles with the same element type
+	class tuningCache
+	{
+	public:
+		std::mutex mtx;
+		std::map<tuningKey, tuningEntry> entries;
 	};
 
-private:
-	std::vector<ET> field;
+	static tuningCache& tuning()
+	{
+		static tuningCache cache;
+		return cache;
+	}
+
+	//must be called with locked tuning().mtx, entry of a new key starts with the first stage
+	static tuningEntry& entryFor(const tuningKey& key)
+	{
+		tuningEntry& entry = tuning().entries[key];
+		if (entry.stage == 0 && entry.candidates.empty())
+		{
+			entry.candidates = threadCandidates(key.first);
+			//circle shorter than R (or empty) has no candidate, there is nothing to tune and it is computed by one thread
+			if (entry.candidates.empty())
+			{
+				entry.stage = 2;
+			}
+		}
+		return entry;
+	}
+
+	field_t<ET> field;
 };
 
 
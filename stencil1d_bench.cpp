@@ -0,0 +1,179 @@
+// stencil1d_bench.cpp : measures throughput and scaling of circle::run. Prints CSV to the standard output.
+// Usage: stencil1d_bench [quick]
+//
+
+#include "stencil1d.hpp"
+#include <iostream>
+#include <string>
+#include <cmath>
+
+//cheap functor - cost of the run is mostly memory traffic and synchronization
+class trivialRule
+{
+public:
+	template<typename T>
+	T operator()(const T& left, const T& center, const T& right) const
+	{
+		return (left + center + right) / 3;
+	}
+};
+
+//expensive functor - tens of floating point operations per cell
+class expensiveRule
+{
+public:
+	template<typename T>
+	T operator()(const T& left, const T& center, const T& right) const
+	{
+		double x = static_cast<double>(left) + center + right;
+		for (int i = 0; i < 8; i++)
+		{
+			x = std::sin(x) + std::sqrt(std::abs(x) + 1);
+		}
+		return static_cast<T>(x);
+	}
+};
+
+class measurement
+{
+public:
+	double seconds;
+	double compute;
+	double wait;
+};
+
+//runs g generations of circle of given size once, returns wall time and average compute and wait time of one worker
+template<typename ET, typename SF>
+measurement measure(std::size_t size, std::size_t g, std::size_t thrs)
+{
+	circle<ET> field(size);
+	for (std::size_t i = 0; i < size; i++)
+	{
+		field.set(i, static_cast<ET>(i % 101));
+	}
+	typename circle<ET>::configuration config{ std::max<std::size_t>(size / thrs / 32, 1), thrs, true };
+
+	auto start = std::chrono::steady_clock::now();
+	auto times = field.runMeasured(SF(), g, config);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	measurement result{ elapsed.count(), 0, 0 };
+	for (auto& t : times)
+	{
+		result.compute += t.compute / times.size();
+		result.wait += t.wait / times.size();
+	}
+	return result;
+}
+
+void printHeader()
+{
+	std::cout << "section,type,functor,size,generations,threads,seconds,generations_per_s,cells_per_s,compute_s,wait_s,speedup,efficiency" << std::endl;
+}
+
+void printRow(const std::string& section, const std::string& type, const std::string& functor, std::size_t size, std::size_t g, std::size_t thrs,
+	const measurement& m, double reference)
+{
+	//reference is time of the same work with one thread (strong scaling) or of the per thread work with one thread (weak scaling)
+	double speedup = section == "weak" ? reference / m.seconds * thrs : reference / m.seconds;
+	std::cout << section << "," << type << "," << functor << "," << size << "," << g << "," << thrs << "," << m.seconds << ","
+		<< g / m.seconds << "," << double(size) * g / m.seconds << "," << m.compute << "," << m.wait << ","
+		<< speedup << "," << speedup / thrs << std::endl;
+}
+
+std::vector<std::size_t> threadCounts()
+{
+	std::size_t hardware = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+	std::vector<std::size_t> counts;
+	for (std::size_t thrs = 1; thrs < hardware; thrs *= 2)
+	{
+		counts.push_back(thrs);
+	}
+	counts.push_back(hardware);
+	return counts;
+}
+
+//all combinations of sizes (from L1 resident to beyond last level cache), generations and thread counts which fit into the budget of cell updates
+template<typename ET, typename SF>
+void matrix(const std::string& type, const std::string& functor, const std::vector<std::size_t>& sizes, double budget)
+{
+	for (auto size : sizes)
+	{
+		for (std::size_t g : { 16, 256, 4096 })
+		{
+			if (double(size) * g > budget)
+			{
+				continue;
+			}
+			double reference = 0;
+			for (auto thrs : threadCounts())
+			{
+				if (thrs > size)
+				{
+					break;
+				}
+				measurement m = measure<ET, SF>(size, g, thrs);
+				if (thrs == 1)
+				{
+					reference = m.seconds;
+				}
+				printRow("matrix", type, functor, size, g, thrs, m, reference);
+			}
+		}
+	}
+}
+
+//strong scaling - the same field computed by more and more threads
+template<typename ET, typename SF>
+void strongScaling(const std::string& type, const std::string& functor, std::size_t size, std::size_t g)
+{
+	double reference = 0;
+	for (auto thrs : threadCounts())
+	{
+		measurement m = measure<ET, SF>(size, g, thrs);
+		if (thrs == 1)
+		{
+			reference = m.seconds;
+		}
+		printRow("strong", type, functor, size, g, thrs, m, reference);
+	}
+}
+
+//weak scaling - every thread gets the same number of elements, so the field grows with threads
+template<typename ET, typename SF>
+void weakScaling(const std::string& type, const std::string& functor, std::size_t sizePerThread, std::size_t g)
+{
+	double reference = 0;
+	for (auto thrs : threadCounts())
+	{
+		measurement m = measure<ET, SF>(sizePerThread * thrs, g, thrs);
+		if (thrs == 1)
+		{
+			reference = m.seconds;
+		}
+		printRow("weak", type, functor, sizePerThread * thrs, g, thrs, m, reference);
+	}
+}
+
+template<typename ET>
+void benchmarkType(const std::string& type, bool quick)
+{
+	std::vector<std::size_t> sizes = quick ? std::vector<std::size_t>{ 1 << 10, 1 << 15, 1 << 18 } : std::vector<std::size_t>{ 1 << 10, 1 << 15, 1 << 20, 1 << 24 };
+	double budget = quick ? 1 << 24 : 1 << 30;
+
+	matrix<ET, trivialRule>(type, "trivial", sizes, budget);
+	matrix<ET, expensiveRule>(type, "expensive", sizes, budget / 16);
+
+	strongScaling<ET, trivialRule>(type, "trivial", quick ? 1 << 16 : 1 << 22, 64);
+	strongScaling<ET, expensiveRule>(type, "expensive", quick ? 1 << 14 : 1 << 18, 64);
+	weakScaling<ET, trivialRule>(type, "trivial", quick ? 1 << 14 : 1 << 18, 64);
+	weakScaling<ET, expensiveRule>(type, "expensive", quick ? 1 << 12 : 1 << 16, 64);
+}
+
+int main(int argc, char** argv)
+{
+	bool quick = argc > 1 && std::string(argv[1]) == "quick";
+	printHeader();
+	benchmarkType<int>("int", quick);
+	benchmarkType<double>("double", quick);
+}
@@ -0,0 +1,269 @@
+#pragma once
+#include "stencil1d.hpp"
+#include <deque>
+
+/*Pool of threads which execute tasks. Every worker has its own queue, takes tasks from its back and when it is empty, steals from the front
+of the queues of the others, so uneven tasks are balanced without any central queue. Workers are pinned to cores only when asked, like in circle::run.*/
+class workStealingPool
+{
+public:
+	explicit workStealingPool(std::size_t thrs = std::thread::hardware_concurrency(), bool pinned = false) :queues(std::max<std::size_t>(thrs, 1))
+	{
+		std::vector<int> cores;
+		if (pinned)
+		{
+			cores = availableCores();
+		}
+		for (size_t th = 0; th < queues.size(); th++)
+		{
+			int core = cores.empty() ? -1 : cores[th % cores.size()];
+			workers.push_back(std::thread([this, th, core]()
+				{
+					pinToCore(core);
+					work(th);
+				}));
+		}
+	}
+	workStealingPool(const workStealingPool&) = delete;
+	workStealingPool& operator=(const workStealingPool&) = delete;
+	~workStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+	}
+
+	std::size_t threads() const
+	{
+		return queues.size();
+	}
+
+	/*tasks are spread over the queues round robin, so every worker starts with its own share. They are counted before any of them can be taken,
+	so a worker which takes one never sees the counters below it.*/
+	void submit(std::vector<std::function<void()>>&& tasks)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			size_t first = next;
+			next = (next + tasks.size()) % queues.size();
+			queued += tasks.size();
+			pending += tasks.size();
+			for (size_t i = 0; i < tasks.size(); i++)
+			{
+				queue& q = queues[(first + i) % queues.size()];
+				std::lock_guard<std::mutex> queueLock(q.mtx);
+				q.tasks.push_back(std::move(tasks[i]));
+			}
+		}
+		condition.notify_all();
+	}
+
+	//waits until all submitted tasks are done
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		while (pending != 0)
+		{
+			doneCondition.wait(lock);
+		}
+	}
+
+private:
+	class queue
+	{
+	public:
+		std::mutex mtx;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool take(std::size_t th, std::function<void()>& task)
+	{
+		for (size_t i = 0; i < queues.size(); i++)
+		{
+			queue& q = queues[(th + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(q.mtx);
+			if (!q.tasks.empty())
+			{
+				//own queue from the back (most recently added), the others from the front
+				if (i == 0)
+				{
+					task = std::move(q.tasks.back());
+					q.tasks.pop_back();
+				}
+				else
+				{
+					task = std::move(q.tasks.front());
+					q.tasks.pop_front();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(std::size_t th)
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			if (take(th, task))
+			{
+				{
+					std::lock_guard<std::mutex> lock(mtx);
+					queued--;
+				}
+				task();
+				std::lock_guard<std::mutex> lock(mtx);
+				if (--pending == 0)
+				{
+					doneCondition.notify_all();
+				}
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mtx);
+			while (queued == 0 && !stopping)
+			{
+				condition.wait(lock);
+			}
+			if (stopping && queued == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	std::vector<queue> queues;
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable condition;
+	std::condition_variable doneCondition;
+	std::size_t queued = 0;
+	std::size_t pending = 0;
+	std::size_t next = 0;
+	bool stopping = false;
+};
+
+/*Many independent rings computed by one functor on a shared pool of threads. Rings are too small to be split between threads, so each task computes
+all generations of a few rings. Rings of the same size are computed together in structure of arrays layout - L rings are interleaved, so cell x of
+all of them is in L consecutive elements and one step of the inner loop (one SIMD lane) computes one ring.*/
+template<typename ET, std::size_t R = 1, std::size_t L = 8>
+class ensemble
+{
+public:
+	explicit ensemble(std::size_t thrs = std::thread::hardware_concurrency(), bool pinned = false) :pool(thrs, pinned) {}
+
+	//adds ring of s elements of value ET(), returns its index
+	std::size_t add(std::size_t s)
+	{
+		rings.push_back(std::vector<ET>(s));
+		return rings.size() - 1;
+	}
+
+	std::size_t count() const
+	{
+		return rings.size();
+	}
+
+	std::size_t size(std::size_t ring) const
+	{
+		return rings[ring].size();
+	}
+
+	//Computes real index by adding size() to parametr and then aplying mod size(), sets value of indexed element of given ring
+	void set(std::size_t ring, std::ptrdiff_t x, const ET& v)
+	{
+		rings[ring][(x + size(ring)) % size(ring)] = v;
+	}
+
+	//Computes real index by adding size() to parametr and then aplying mod size(), gets value of indexed element of given ring
+	decltype(auto) get(std::size_t ring, std::ptrdiff_t x) const
+	{
+		return rings[ring][(x + size(ring)) % size(ring)];
+	}
+
+	//computes g generations of all rings. Functor is called from all threads of the pool at once, the same as in circle::run.
+	template<typename SF>
+	void run(SF&& sf, std::size_t g)
+	{
+		std::map<std::size_t, std::vector<std::size_t>> bySize;
+		for (size_t ring = 0; ring < rings.size(); ring++)
+		{
+			//empty rings have no cells to compute
+			if (rings[ring].size() != 0)
+			{
+				bySize[rings[ring].size()].push_back(ring);
+			}
+		}
+
+		std::vector<std::function<void()>> tasks;
+		for (auto& group : bySize)
+		{
+			for (size_t first = 0; first < group.second.size(); first += L)
+			{
+				std::vector<std::size_t> block(group.second.begin() + first, group.second.begin() + std::min(first + L, group.second.size()));
+				tasks.push_back([this, &sf, g, block = std::move(block)]()
+					{
+						computeBlock(sf, g, block);
+					});
+			}
+		}
+		pool.submit(std::move(tasks));
+		pool.wait();
+	}
+
+private:
+	/*computes g generations of up to L rings of the same size. Storage has R rows of halo on both sides, which are copied from the other end
+	of the rings before each generation. Unused lanes of the last block are copies of its first ring, their results are thrown away.*/
+	template<typename SF>
+	void computeBlock(SF& sf, std::size_t g, const std::vector<std::size_t>& block)
+	{
+		size_t n = rings[block[0]].size();
+		std::vector<ET> storage((n + 2 * R) * L);
+		std::vector<ET> secondaryStorage(storage.size());
+		for (size_t lane = 0; lane < L; lane++)
+		{
+			const std::vector<ET>& ring = rings[block[lane < block.size() ? lane : 0]];
+			for (size_t x = 0; x < n; x++)
+			{
+				storage[(x + R) * L + lane] = ring[x];
+			}
+		}
+
+		for (size_t generation = 0; generation < g; generation++)
+		{
+			for (size_t h = 0; h < R; h++)
+			{
+				std::copy_n(storage.begin() + ((h + n * R - R) % n + R) * L, L, storage.begin() + h * L);
+				std::copy_n(storage.begin() + (h % n + R) * L, L, storage.begin() + (n + R + h) * L);
+			}
+			for (size_t x = R; x < n + R; x++)
+			{
+				const ET* window = storage.data() + (x - R) * L;
+				ET* out = secondaryStorage.data() + x * L;
+				for (size_t lane = 0; lane < L; lane++)
+				{
+					out[lane] = stencilKernel<ET, R>::apply(sf, window + lane, L);
+				}
+			}
+			std::swap(storage, secondaryStorage);
+		}
+
+		for (size_t lane = 0; lane < block.size(); lane++)
+		{
+			std::vector<ET>& ring = rings[block[lane]];
+			for (size_t x = 0; x < n; x++)
+			{
+				ring[x] = storage[(x + R) * L + lane];
+			}
+		}
+	}
+
+	std::vector<std::vector<ET>> rings;
+	workStealingPool pool;
+};
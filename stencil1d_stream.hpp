@@ -0,0 +1,185 @@
+#pragma once
+#include "stencil1d.hpp"
+#include <fstream>
+#include <string>
+#include <stdexcept>
+
+/*Version of circle for fields larger than memory. The field is a file of raw values of ET, which is processed by chunks. Each chunk is read together with
+halo of G * R elements on both sides, G generations are computed in memory and the chunk is written back, so every element is read and written once per G generations.
+The file is rewritten in place - values which the next chunk needs from the previous one (and the last chunk from the first one) are kept from the moment they were read.*/
+template<typename ET, std::size_t R = 1>
+class streamedCircle
+{
+	static_assert(std::is_trivially_copyable_v<ET>, "elements are stored in the file as raw bytes");
+public:
+	//opens existing file, size of the field is length of the file divided by sizeof(ET). Throws std::runtime_error when it cannot be opened.
+	explicit streamedCircle(const std::string& path) :file(path, std::ios::in | std::ios::out | std::ios::binary)
+	{
+		check(path, "cannot open ");
+		file.seekg(0, std::ios::end);
+		std::streamoff length = file.tellg();
+		if (length < 0)
+		{
+			throw std::runtime_error("cannot get size of " + path);
+		}
+		count = static_cast<std::size_t>(length) / sizeof(ET);
+	}
+
+	//creates (or overwrites) the file with s elements of value ET(). Throws std::runtime_error when it cannot be written.
+	streamedCircle(const std::string& path, std::size_t s) :count(s)
+	{
+		{
+			std::ofstream created(path, std::ios::binary | std::ios::trunc);
+			std::vector<ET> zeros(std::min(s, chunk));
+			for (size_t written = 0; written < s && created; written += zeros.size())
+			{
+				created.write(reinterpret_cast<const char*>(zeros.data()), std::min(zeros.size(), s - written) * sizeof(ET));
+			}
+			created.flush();
+			if (!created)
+			{
+				throw std::runtime_error("cannot create " + path);
+			}
+		}
+		file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+		check(path, "cannot open ");
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	//number of elements which are held in memory at once (without halos), every thread of run gets its part of the chunk
+	void setChunk(std::size_t elements)
+	{
+		chunk = std::max<std::size_t>(elements, 1);
+	}
+
+	//Computes real index by adding size() to parametr and then aplying mod size(), writes one element to the file
+	void set(std::ptrdiff_t x, const ET& v)
+	{
+		writeRange((x + size()) % size(), 1, &v);
+	}
+
+	//Computes real index by adding size() to parametr and then aplying mod size(), reads one element from the file
+	ET get(std::ptrdiff_t x)
+	{
+		ET v;
+		readRange((x + size()) % size(), 1, &v);
+		return v;
+	}
+
+	//computes g generations by passes over the file, each pass computes G generations (G = chunk / 32 / R if not given). Size of the field must be at least R.
+	template<typename SF>
+	void run(SF&& sf, std::size_t g, std::size_t G = 0, std::size_t thrs = std::thread::hardware_concurrency())
+	{
+		if (G == 0)
+		{
+			G = std::max<std::size_t>(chunk / 32 / R, 1);
+		}
+		G = std::max<std::size_t>(std::min(G, size() / R), 1);
+		for (size_t generationIndex = 0; generationIndex < g; generationIndex += G)
+		{
+			pass(sf, std::min(G, g - generationIndex), std::max<std::size_t>(thrs, 1));
+		}
+		file.flush();
+		check("the field file", "cannot flush ");
+	}
+
+private:
+	//one pass over the whole file, computes given number of generations
+	template<typename SF>
+	void pass(SF& sf, std::size_t generations, std::size_t thrs)
+	{
+		size_t N = size();
+		size_t halo = generations * R;
+		size_t C = std::max(chunk, halo);
+
+		std::vector<ET> savedHead(halo);
+		readRange(0, halo, savedHead.data());
+		std::vector<ET> leftHalo(halo);
+		readRange(N - halo, halo, leftHalo.data());
+
+		std::vector<ET> buffer;
+		std::vector<ET> computed;
+		for (size_t start = 0; start < N; start += C)
+		{
+			size_t length = std::min(C, N - start);
+			buffer.resize(halo + length + halo);
+			computed.resize(length);
+
+			std::copy(leftHalo.begin(), leftHalo.end(), buffer.begin());
+			readRange(start, length, buffer.data() + halo);
+			//right halo is still unchanged in the file, only the part behind the end of the file was already overwritten
+			size_t fromFile = std::min(halo, N - start - length);
+			readRange(start + length, fromFile, buffer.data() + halo + length);
+			std::copy(savedHead.begin(), savedHead.begin() + (halo - fromFile), buffer.begin() + halo + length + fromFile);
+			//old end of this chunk is left halo of the next one
+			if (length >= halo)
+			{
+				std::copy(buffer.begin() + length, buffer.begin() + length + halo, leftHalo.begin());
+			}
+
+			computeChunk(sf, buffer, computed, generations, thrs);
+			writeRange(start, length, computed.data());
+		}
+	}
+
+	/*computes chunk in buffer (with halos) by threads. Each thread copies its part of the buffer with its own halos, so threads do not have to exchange anything
+	and write their results to disjoint parts of computed.*/
+	template<typename SF>
+	void computeChunk(SF& sf, const std::vector<ET>& buffer, std::vector<ET>& computed, std::size_t generations, std::size_t thrs)
+	{
+		size_t halo = generations * R;
+		size_t length = computed.size();
+		thrs = std::max<std::size_t>(std::min(thrs, length / std::max<std::size_t>(halo, 1)), 1);
+		size_t W = length / thrs;
+
+		std::vector<std::thread> workers;
+		size_t first = 0;
+		for (size_t th = 0; th < thrs; th++)
+		{
+			size_t part = length % thrs > th ? W + 1 : W;
+			workers.push_back(std::thread([&, first, part]()
+				{
+					std::vector<ET> storage(buffer.begin() + first, buffer.begin() + first + part + 2 * halo);
+					std::vector<ET> secondaryStorage(storage.size());
+					stencilKernel<ET, R>::generations(sf, storage, secondaryStorage, generations);
+					std::copy(storage.begin() + halo, storage.begin() + halo + part, computed.begin() + first);
+				}));
+			first += part;
+		}
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+	}
+
+	//a short read or a failed write would silently corrupt the field, so every access of the file is checked and throws std::runtime_error
+	void readRange(std::size_t position, std::size_t elements, ET* destination)
+	{
+		file.seekg(position * sizeof(ET));
+		file.read(reinterpret_cast<char*>(destination), elements * sizeof(ET));
+		check("the field file", "cannot read ");
+	}
+
+	void writeRange(std::size_t position, std::size_t elements, const ET* source)
+	{
+		file.seekp(position * sizeof(ET));
+		file.write(reinterpret_cast<const char*>(source), elements * sizeof(ET));
+		check("the field file", "cannot write ");
+	}
+
+	void check(const std::string& what, const char* failure)
+	{
+		if (!file)
+		{
+			throw std::runtime_error(failure + what);
+		}
+	}
+
+	std::fstream file;
+	std::size_t count = 0;
+	std::size_t chunk = 1 << 20;
+};
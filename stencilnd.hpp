@@ -0,0 +1,262 @@
+#pragma once
+#include "stencil1d.hpp"
+#include <array>
+
+//Shape of the neighbourhood of one cell. vonNeumann contains cells within manhattan distance radius, moore cells within chebyshev distance radius.
+enum class neighbourhood
+{
+	vonNeumann,
+	moore
+};
+
+/*D dimensional version of circle - every dimension is periodic. The functor is called as sf(center, neighbours) where neighbours is cellView of values in the
+neighbourhood of given shape and radius (without the center), in the order of offsets(). The field is divided to tiles of whole rows (slices along the first dimension), one for each thread.
+Threads exchange halos of G * radius rows with their neighbors through the same channels as circle, so G generations are computed between two exchanges.*/
+template<typename ET, std::size_t D>
+class torus
+{
+public:
+	using coordinates = std::array<std::ptrdiff_t, D>;
+
+	//every extent should be at least radius, otherwise halo of one tile would be longer than the tile
+	torus(const std::array<std::size_t, D>& extents, std::size_t radius = 1, neighbourhood shape = neighbourhood::moore)
+		:extents(extents), radius(radius), field(product(extents))
+	{
+		createOffsets(shape);
+		createShiftTables();
+	}
+
+	std::size_t size() const
+	{
+		return field.size();
+	}
+
+	std::size_t extent(std::size_t dimension) const
+	{
+		return extents[dimension];
+	}
+
+	//offsets of the neighbours, in the order in which their values are given to the functor
+	const std::vector<coordinates>& offsets() const
+	{
+		return neighbourOffsets;
+	}
+
+	//Each coordinate is taken modulo its extent, sets value of indexed element
+	void set(const coordinates& x, const ET& v)
+	{
+		field[index(x)] = v;
+	}
+
+	//Each coordinate is taken modulo its extent, gets value of indexed element
+	decltype(auto) get(const coordinates& x) const
+	{
+		return field[index(x)];
+	}
+
+	//run divides rows of the field to threads and calls oneTileComputing on each of them
+	template<typename SF>
+	void run(SF&& sf, std::size_t g, std::size_t thrs = std::thread::hardware_concurrency())
+	{
+		size_t rows = extents[0];
+		thrs = std::max<size_t>(std::min(thrs, rows / radius), 1);
+
+		std::vector<package<ET>> toLeft(thrs);
+		std::vector<package<ET>> toRight(thrs);
+		std::vector<ET> result(size());
+
+		std::vector<std::thread> workers;
+		size_t W = rows / thrs;
+		size_t G = std::max<size_t>(W / 32 / radius, 1);
+
+		size_t firstRow = 0;
+		for (size_t th = 0; th < thrs; th++)
+		{
+			size_t tileRows = rows % thrs > th ? W + 1 : W;
+			workers.push_back(std::thread([&, th, firstRow, tileRows]()
+				{
+					oneTileComputing(firstRow, tileRows, G, sf, g, result, toLeft[th], toRight[th], toRight[(th - 1 + thrs) % thrs], toLeft[(th + 1) % thrs]);
+				}));
+			firstRow += tileRows;
+		}
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+		field = std::move(result);
+	}
+
+private:
+	/*this is the function which is done by each thread. Storage of the tile is one vector of rows - halo from left neighbor, rows of this tile
+	and halo from right neighbor. In each generation the valid part shrinks by radius rows on both sides.*/
+	template<typename SF>
+	void oneTileComputing(size_t firstRow, size_t tileRows, size_t generationsBlock, SF& sf, size_t generationsTotal, std::vector<ET>& result,
+		package<ET>& toLeft, package<ET>& toRight, package<ET>& fromLeft, package<ET>& fromRight)
+	{
+		size_t rowSize = size() / extents[0];
+		size_t halo = generationsBlock * radius * rowSize;
+		size_t tile = tileRows * rowSize;
+
+		std::vector<ET> storage(halo + tile + halo);
+		std::copy(field.begin() + firstRow * rowSize, field.begin() + firstRow * rowSize + tile, storage.begin() + halo);
+		std::vector<ET> secondaryStorage(storage.size());
+		std::vector<ET> neighbours(neighbourOffsets.size());
+
+		for (size_t generationIndex = 0; generationIndex < generationsTotal; generationIndex += generationsBlock)
+		{
+			//sending
+			{
+				std::lock_guard<std::mutex> lock(toLeft.mtx);
+				toLeft.channel.push(std::vector<ET>(storage.begin() + halo, storage.begin() + 2 * halo));
+			}
+			toLeft.condition.notify_one();
+
+			{
+				std::lock_guard<std::mutex> lock(toRight.mtx);
+				toRight.channel.push(std::vector<ET>(storage.begin() + tile, storage.begin() + tile + halo));
+			}
+			toRight.condition.notify_one();
+			//recieving
+			{
+				std::unique_lock<std::mutex> lock(fromRight.mtx);
+				while (fromRight.channel.empty())
+				{
+					fromRight.condition.wait(lock);
+				}
+				std::copy(fromRight.channel.front().begin(), fromRight.channel.front().end(), storage.begin() + halo + tile);
+				fromRight.channel.pop();
+			}
+			{
+				std::unique_lock<std::mutex> lock(fromLeft.mtx);
+				while (fromLeft.channel.empty())
+				{
+					fromLeft.condition.wait(lock);
+				}
+				std::copy(fromLeft.channel.front().begin(), fromLeft.channel.front().end(), storage.begin());
+				fromLeft.channel.pop();
+			}
+			//computing generationsBlock (or less) generations, only the valid rows
+			for (size_t i = 1; i <= generationsBlock && i + generationIndex <= generationsTotal; i++)
+			{
+				size_t validRows = storage.size() / rowSize - i * radius;
+				for (size_t row = i * radius; row < validRows; row++)
+				{
+					computeRow(row, rowSize, sf, storage, secondaryStorage, neighbours);
+				}
+				std::swap(secondaryStorage, storage);
+			}
+		}
+		//each thread writes only its own rows, so no lock is needed
+		std::copy(storage.begin() + halo, storage.begin() + halo + tile, result.begin() + firstRow * rowSize);
+	}
+
+	//computes one row of the storage, cells of the row are visited in order, their coordinates in other dimensions are counted along
+	template<typename SF>
+	void computeRow(size_t row, size_t rowSize, SF& sf, const std::vector<ET>& storage, std::vector<ET>& secondaryStorage, std::vector<ET>& neighbours)
+	{
+		std::array<size_t, D> cell{};
+		for (size_t c = 0; c < rowSize; c++)
+		{
+			for (size_t n = 0; n < neighbourOffsets.size(); n++)
+			{
+				size_t position = (row + neighbourOffsets[n][0]) * rowSize;
+				for (size_t k = 1; k < D; k++)
+				{
+					position += shifted[k][(neighbourOffsets[n][k] + radius) * extents[k] + cell[k]];
+				}
+				neighbours[n] = storage[position];
+			}
+			secondaryStorage[row * rowSize + c] = sf(storage[row * rowSize + c], cellView<ET>(neighbours.data(), neighbours.size()));
+
+			for (size_t k = D - 1; k > 0; k--)
+			{
+				if (++cell[k] < extents[k])
+				{
+					break;
+				}
+				cell[k] = 0;
+			}
+		}
+	}
+
+	//all offsets with coordinates from -radius to radius which belong to the shape, except the center
+	void createOffsets(neighbourhood shape)
+	{
+		std::ptrdiff_t r = radius;
+		coordinates offset;
+		offset.fill(-r);
+		while (true)
+		{
+			std::ptrdiff_t manhattan = 0;
+			bool center = true;
+			for (auto x : offset)
+			{
+				manhattan += std::abs(x);
+				center = center && x == 0;
+			}
+			if (!center && (shape == neighbourhood::moore || manhattan <= r))
+			{
+				neighbourOffsets.push_back(offset);
+			}
+
+			size_t k = D;
+			while (k > 0 && offset[k - 1] == r)
+			{
+				offset[k - 1] = -r;
+				k--;
+			}
+			if (k == 0)
+			{
+				break;
+			}
+			offset[k - 1]++;
+		}
+	}
+
+	/*shifted[k][(d + radius) * extents[k] + c] is position of coordinate c + d (modulo extents[k]) in the row, multiplied by the stride of dimension k.
+	The first dimension is never wrapped inside of a tile, halos are used instead.*/
+	void createShiftTables()
+	{
+		size_t stride = 1;
+		for (size_t k = D; k-- > 1;)
+		{
+			std::ptrdiff_t n = extents[k];
+			shifted[k].resize((2 * radius + 1) * extents[k]);
+			for (std::ptrdiff_t d = -std::ptrdiff_t(radius); d <= std::ptrdiff_t(radius); d++)
+			{
+				for (std::ptrdiff_t c = 0; c < n; c++)
+				{
+					shifted[k][(d + radius) * n + c] = (((c + d) % n + n) % n) * stride;
+				}
+			}
+			stride *= extents[k];
+		}
+	}
+
+	std::size_t index(const coordinates& x) const
+	{
+		size_t result = 0;
+		for (size_t k = 0; k < D; k++)
+		{
+			std::ptrdiff_t n = extents[k];
+			result = result * extents[k] + ((x[k] % n) + n) % n;
+		}
+		return result;
+	}
+
+	static std::size_t product(const std::array<std::size_t, D>& extents)
+	{
+		size_t result = 1;
+		for (auto e : extents)
+		{
+			result *= e;
+		}
+		return result;
+	}
+
+	std::array<std::size_t, D> extents;
+	std::size_t radius;
+	std::vector<coordinates> neighbourOffsets;
+	std::array<std::vector<size_t>, D> shifted;
+	std::vector<ET> field;
+};